@@ -74,7 +74,8 @@ static int single_thread_mat_mul() {
 static int multi_thread_mat_mul() {
   dispatch_queue_t* queue;
   dispatch_group_t* group;
-  worker_arg_t args[NUM_THREADS];
+  dispatch_task_t* task;
+  worker_arg_t* arg;
   int queue_length = NUM_THREADS;
   int queue_thread_count = NUM_THREADS;
   hwtimer_t hwtimer;
@@ -89,12 +90,15 @@ static int multi_thread_mat_mul() {
   group = dispatch_group_create(queue_thread_count, true);
 
   // initialize NUM_THREADS tasks, add them to the group
+  // the arguments are allocated with the tasks and freed with them
   int num_rows = ROWS / NUM_THREADS;
   for (int i = 0; i < NUM_THREADS; i++) {
-    args[i].start_row = i * num_rows;
-    args[i].end_row = args[i].start_row + num_rows;
+    task = dispatch_task_create_with_payload(
+        do_matrix_multiply, sizeof(worker_arg_t), (void**)&arg, false);
+    arg->start_row = i * num_rows;
+    arg->end_row = arg->start_row + num_rows;
 
-    dispatch_group_function_add(group, do_matrix_multiply, &args[i]);
+    dispatch_group_task_add(group, task);
   }
 
   hwtimer = hwtimer_alloc();
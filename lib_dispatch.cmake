@@ -4,13 +4,18 @@ if(NOT DEFINED LIB_DISPATCH_DIR)
 endif()
 
 set(LIB_DISPATCH_SOURCES
+  "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_allocator.c"
   "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_task.c"
   "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_group.c"
+  "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_completion.c"
+  "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_graph.c"
+  "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_scratch.c"
 )
 
 set(LIB_DISPATCH_HOST_SOURCES
   ${LIB_DISPATCH_SOURCES}
   "${LIB_DISPATCH_DIR}/lib_dispatch/src/dispatch_queue_host.cc"
+  "${LIB_DISPATCH_DIR}/lib_dispatch/src/topology_host.cc"
 )
 
 set(LIB_DISPATCH_METAL_SOURCES
@@ -3,6 +3,9 @@
 #ifndef LIB_DISPATCH_H_
 #define LIB_DISPATCH_H_
 
+#include "dispatch_allocator.h"
+#include "dispatch_completion.h"
+#include "dispatch_graph.h"
 #include "dispatch_group.h"
 #include "dispatch_queue.h"
 #include "dispatch_task.h"
@@ -0,0 +1,51 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_ALLOCATOR_H_
+#define DISPATCH_ALLOCATOR_H_
+
+#include <stddef.h>
+
+#ifdef XCORE
+#define DISPATCH_ALLOCATOR_FUNCTION \
+  __attribute__((fptrgroup("dispatch_allocator")))
+#else
+#define DISPATCH_ALLOCATOR_FUNCTION
+#endif
+
+typedef void *(*dispatch_malloc_t)(void *context, size_t size);
+typedef void (*dispatch_free_t)(void *context, void *ptr);
+
+typedef struct dispatch_allocator_struct dispatch_allocator_t;
+struct dispatch_allocator_struct {
+  dispatch_malloc_t malloc;  // returns memory aligned like malloc
+  dispatch_free_t free;      // frees memory returned by malloc
+  void *context;             // passed to malloc and free
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+/** Set the global allocator
+ *
+ * The global allocator is used for the tasks, groups, completion queues,
+ * graphs and dispatch queues created after it is set.  Each object keeps the
+ * allocator it was created with and frees its memory to it, so the allocator
+ * must outlive every object created while it was set.  By default the
+ * global allocator calls dispatch_malloc and dispatch_free.
+ *
+ * \param allocator  Allocator object, or NULL to restore the default
+ */
+void dispatch_allocator_set(const dispatch_allocator_t *allocator);
+
+/** Get the global allocator
+ *
+ * @return  The allocator set by dispatch_allocator_set, or the default
+ */
+const dispatch_allocator_t *dispatch_allocator_get();
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_ALLOCATOR_H_
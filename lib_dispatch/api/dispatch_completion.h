@@ -0,0 +1,102 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_COMPLETION_H_
+#define DISPATCH_COMPLETION_H_
+
+#include <stddef.h>
+
+#include "dispatch_queue.h"
+#include "dispatch_task.h"
+
+typedef struct dispatch_completion_struct dispatch_completion_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+/** Create a new completion queue
+ *
+ * Workers push the tasks that are bound to a completion queue when they
+ * finish executing.  The caller reaps finished tasks in batches with
+ * dispatch_completion_poll or dispatch_completion_wait, instead of waiting on
+ * each task.  The completion queue is a lock-free ring, so its length must
+ * be at least the number of bound tasks that are not yet reaped.
+ *
+ * \param length  Maximum number of finished tasks, rounded up to a power of 2
+ *
+ * \return        New completion queue object
+ */
+dispatch_completion_t *dispatch_completion_create(size_t length);
+
+/** Free memory allocated by dispatch_completion_create.  Tasks that have not
+ * been reaped are deleted.
+ *
+ * \param completion  Completion queue object
+ */
+void dispatch_completion_delete(dispatch_completion_t *completion);
+
+/** Bind the task to the completion queue
+ *
+ * The task must not be waitable.  When the task has finished executing, the
+ * worker pushes it to the completion queue instead of deleting it.
+ *
+ * The task must not have been created with dispatch_task_create_with_payload.
+ * Reaping deletes the task and returns its argument, and a payload is freed
+ * with its task, so dispatch_assert fails if a payload task is bound.
+ *
+ * \param task        Task object
+ * \param completion  Completion queue object
+ */
+void dispatch_task_set_completion(dispatch_task_t *task,
+                                  dispatch_completion_t *completion);
+
+/** Reap finished tasks without blocking
+ *
+ * The reaped tasks are deleted, their arguments are returned so the caller
+ * can identify them.
+ *
+ * \param completion  Completion queue object
+ * \param arguments   Array that is filled with the reaped tasks' arguments
+ * \param count       Maximum number of tasks to reap
+ *
+ * \return            Number of tasks reaped
+ */
+size_t dispatch_completion_poll(dispatch_completion_t *completion,
+                                void **arguments, size_t count);
+
+/** Reap finished tasks, blocking in the caller's thread until at least one
+ * task has finished.  See dispatch_completion_poll.
+ *
+ * \param completion  Completion queue object
+ * \param arguments   Array that is filled with the reaped tasks' arguments
+ * \param count       Maximum number of tasks to reap, must be at least 1
+ *
+ * \return            Number of tasks reaped
+ */
+size_t dispatch_completion_wait(dispatch_completion_t *completion,
+                                void **arguments, size_t count);
+
+/** Creates a task that is bound to the completion queue and adds it to the
+ * queue
+ *
+ * \param ctx         Dispatch queue object
+ * \param completion  Completion queue object
+ * \param function    Function to perform, signature must be
+ * <tt>void(void*)</tt>
+ * \param argument    Function argument, returned when the task is reaped
+ */
+static inline void dispatch_completion_function_add(
+    dispatch_queue_t *ctx, dispatch_completion_t *completion,
+    dispatch_function_t function, void *argument) {
+  dispatch_task_t *task;
+
+  task = dispatch_task_create(function, argument, false);
+  dispatch_task_set_completion(task, completion);
+  dispatch_queue_task_add(ctx, task);
+}
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_COMPLETION_H_
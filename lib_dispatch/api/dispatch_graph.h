@@ -0,0 +1,99 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_GRAPH_H_
+#define DISPATCH_GRAPH_H_
+
+#include <stddef.h>
+
+#include "dispatch_queue.h"
+#include "dispatch_task.h"
+
+typedef struct dispatch_graph_struct dispatch_graph_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+/** Create a new task graph and begin capturing it
+ *
+ * A graph records a fixed set of tasks and the dependencies between them
+ * once, and is then launched as many times as needed.  The graph's tasks,
+ * completion counter and adjacency are allocated when it is captured, so a
+ * launch does not allocate.
+ *
+ * \param length  Maximum number of tasks in the graph
+ *
+ * \return        Graph object
+ */
+dispatch_graph_t *dispatch_graph_create(size_t length);
+
+/** Capture a task in the graph
+ *
+ * The task is performed after all of its dependencies have finished.
+ * Dependencies are the indices returned when earlier tasks were captured, so
+ * the graph can not contain a cycle.
+ *
+ * \param graph             Graph object, must not be finalized
+ * \param function          Function to perform, signature must be
+ * <tt>void(void*)</tt>
+ * \param argument          Function argument
+ * \param dependencies      Array of the indices of the tasks this task
+ * depends on, may be NULL if there are none
+ * \param dependency_count  Number of dependencies
+ *
+ * \return                  Index of the task in the graph
+ */
+size_t dispatch_graph_function_add(dispatch_graph_t *graph,
+                                   dispatch_function_t function,
+                                   void *argument, const size_t *dependencies,
+                                   size_t dependency_count);
+
+/** End the capture.  The graph is immutable once finalized.
+ *
+ * \param graph  Graph object
+ */
+void dispatch_graph_finalize(dispatch_graph_t *graph);
+
+/** Free memory allocated by dispatch_graph_create
+ *
+ * \param graph  Graph object, must not be running
+ */
+void dispatch_graph_delete(dispatch_graph_t *graph);
+
+/** Launch the graph on the queue
+ *
+ * The tasks without dependencies are added to the queue, the others are
+ * added by the worker that finishes their last dependency.
+ * NOTE: on xcore the queue's length must be at least the number of tasks in
+ * the graph, workers block while adding to a full queue.
+ *
+ * \param ctx    Dispatch queue object
+ * \param graph  Graph object, must be finalized and not running
+ */
+void dispatch_queue_graph_launch(dispatch_queue_t *ctx,
+                                 dispatch_graph_t *graph);
+
+/** Wait for all of the graph's tasks to finish.  The graph can then be
+ * launched again.
+ *
+ * \param ctx    Dispatch queue object
+ * \param graph  Graph object
+ */
+void dispatch_queue_graph_wait(dispatch_queue_t *ctx, dispatch_graph_t *graph);
+
+/** Cancel the graph's tasks until the wait on the graph returns
+ *
+ * The tasks that have not started are skipped, the tasks that depend on them
+ * are still released in order, so dispatch_queue_graph_wait returns once the
+ * tasks already running finish.  The graph can be cancelled before it is
+ * launched, and the next launch after the wait performs every task again.
+ *
+ * \param graph  Graph object
+ */
+void dispatch_graph_cancel(dispatch_graph_t *graph);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_GRAPH_H_
@@ -16,7 +16,9 @@ extern "C" {
 
 /** Create a new task group
  *
- * \param length    Maximum number of tasks in the group
+ * \param length    Initial capacity of the group, the group grows when more
+ * tasks are added.  May be 0 for a group that tasks only join with
+ * dispatch_group_enter.
  * \param waitable  The task is waitable if TRUE, otherwise the task can not
  *
  * \return          Group object
@@ -31,7 +33,8 @@ dispatch_group_t *dispatch_group_create(size_t length, bool waitable);
  */
 void dispatch_group_init(dispatch_group_t *group, bool waitable);
 
-/** Free memory allocated by dispatch_group_create
+/** Free memory allocated by dispatch_group_create.  The tasks of a reusable
+ * group are deleted too.
  *
  * \param group  Group object
  */
@@ -50,12 +53,61 @@ dispatch_task_t *dispatch_group_function_add(dispatch_group_t *group,
                                              void *argument);
 
 /** Add a task to the group
+ *
+ * Several threads may add tasks to the same group concurrently, without a
+ * lock.  The group must not be added to a queue until they have all finished
+ * adding.
  *
  * \param group  Group object
  * \param task   Task to add
  */
 void dispatch_group_task_add(dispatch_group_t *group, dispatch_task_t *task);
 
+/** Make the group reusable
+ *
+ * The tasks and the completion counter of a reusable group persist when the
+ * group's tasks finish, so the same group can be added to a queue over and
+ * over without allocating.  Workers and waits do not delete the tasks, they
+ * are deleted with the group.  Call dispatch_group_reset between waiting on
+ * the group and adding it to a queue again.
+ *
+ * \param group     Group object
+ * \param reusable  The group is reusable if TRUE
+ */
+void dispatch_group_set_reusable(dispatch_group_t *group, bool reusable);
+
+/** Rearm a reusable group for its next submission.  Cancelled tasks are
+ * uncancelled.
+ *
+ * \param group  Group object, must be reusable and not running
+ */
+void dispatch_group_reset(dispatch_group_t *group);
+
+/** Add outstanding work to the group
+ *
+ * The group counts the work that has entered it and not yet left, and a wait
+ * on the group returns when the count reaches zero.  Tasks can join the group
+ * after it has been added to a queue, so dynamically discovered work can
+ * still be waited on with one wait.  Each enter must be balanced with a
+ * dispatch_group_leave.
+ *
+ * \param group  Group object, must be waitable to be waited on
+ */
+void dispatch_group_enter(dispatch_group_t *group);
+
+/** Remove finished work from the group.  See dispatch_group_enter.
+ *
+ * \param group  Group object
+ */
+void dispatch_group_leave(dispatch_group_t *group);
+
+/** Cancel all of the group's tasks.  See dispatch_task_cancel.
+ *
+ * \param group  Group object, must be waitable if it has been added to a
+ * queue
+ */
+void dispatch_group_cancel(dispatch_group_t *group);
+
 /** Run the group's tasks in the caller's thread
  *
  * \param group  Group object
@@ -4,12 +4,61 @@
 #define DISPATCH_QUEUE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include "dispatch_allocator.h"
 #include "dispatch_group.h"
 #include "dispatch_task.h"
 
 typedef void dispatch_queue_t;
 
+typedef uint64_t dispatch_time_t;  // microseconds on a monotonic clock
+
+#define DISPATCH_TIME_FOREVER (UINT64_MAX)
+
+typedef enum {
+  DISPATCH_WAIT_SUCCESS = 0,  // the wait completed
+  DISPATCH_WAIT_TIMEOUT,      // the deadline passed before the wait completed
+} dispatch_wait_status_t;
+
+typedef enum {
+  DISPATCH_PLACEMENT_NONE = 0,  // workers may run on any CPU in the set
+  DISPATCH_PLACEMENT_TOPOLOGY,  // each worker is pinned to one CPU in the set
+} dispatch_placement_t;
+
+typedef enum {
+  DISPATCH_SCHED_DEFAULT = 0,  // time-sharing, thread_nice adds to nice level
+  DISPATCH_SCHED_FIFO,         // real-time, thread_priority sets the priority
+  DISPATCH_SCHED_RR,           // real-time, thread_priority sets the priority
+} dispatch_sched_policy_t;
+
+// Called by each worker before its first task, returns the worker's context
+typedef void* (*dispatch_worker_start_t)(void* argument);
+// Called by each worker after its last task with the worker's context
+typedef void (*dispatch_worker_stop_t)(void* argument, void* context);
+
+typedef struct dispatch_queue_attr_struct dispatch_queue_attr_t;
+struct dispatch_queue_attr_struct {
+  size_t thread_stack_size;  // size (in words) of each worker's stack
+  size_t thread_priority;    // priority of each worker
+  dispatch_sched_policy_t thread_policy;
+  int thread_nice;          // nice increment for DISPATCH_SCHED_DEFAULT
+  bool thread_stack_guard;  // guard page below an explicitly sized stack
+  const int* cpu_set;       // CPUs the workers may run on, NULL for all
+  size_t cpu_set_size;      // number of CPUs in cpu_set
+  dispatch_placement_t placement;
+  dispatch_worker_start_t worker_start;  // NULL if there is no start hook
+  dispatch_worker_stop_t worker_stop;    // NULL if there is no stop hook
+  void* worker_argument;                 // passed to the worker hooks
+  size_t scratch_size;  // size (in bytes) of each worker's scratch arena
+  const dispatch_allocator_t* allocator;  // NULL for the global allocator
+  size_t task_table_length;  // number of tasks in the task table, zero for
+                             // no table
+  size_t shard_count;  // number of submission deques, zero or one for a
+                       // single deque
+  bool single_producer;  // tasks are only added from one thread
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif  // __cplusplus
@@ -28,6 +77,149 @@ dispatch_queue_t* dispatch_queue_create(size_t length, size_t thread_count,
                                         size_t thread_stack_size,
                                         size_t thread_priority);
 
+/** Initialize dispatch queue attributes to their defaults
+ *
+ * \param attr  Dispatch queue attributes
+ */
+static inline void dispatch_queue_attr_init(dispatch_queue_attr_t* attr) {
+  attr->thread_stack_size = 0;
+  attr->thread_priority = 0;
+  attr->thread_policy = DISPATCH_SCHED_DEFAULT;
+  attr->thread_nice = 0;
+  attr->thread_stack_guard = true;
+  attr->cpu_set = NULL;
+  attr->cpu_set_size = 0;
+  attr->placement = DISPATCH_PLACEMENT_NONE;
+  attr->worker_start = NULL;
+  attr->worker_stop = NULL;
+  attr->worker_argument = NULL;
+  attr->scratch_size = 0;
+  attr->allocator = NULL;
+  attr->task_table_length = 0;
+  attr->shard_count = 0;
+  attr->single_producer = false;
+}
+
+/** Create a new dispatch queue with attributes
+ *
+ * The CPU set and placement are only supported by the x86 implementation on
+ * Linux.  With DISPATCH_PLACEMENT_TOPOLOGY, workers are spread across
+ * physical cores before sharing a core's hardware threads, and workers on
+ * the same NUMA node and last level cache are placed next to each other.
+ *
+ * The scheduling policy, nice level and stack guard are only supported by
+ * the x86 implementation.  A thread_stack_size of zero gives the workers the
+ * default stack size.  thread_nice is added to the nice level the workers
+ * inherit from the thread that creates them.  If the process is not
+ * permitted to use a real-time scheduling policy, or to lower its nice
+ * level, the workers are started with the default scheduling instead.
+ *
+ * The worker hooks are supported by all implementations.  Each worker calls
+ * worker_start in its own thread before it performs its first task, so
+ * per-thread resources can be set up off the hot path.  The context that
+ * worker_start returns is passed to worker_stop, which the worker calls after
+ * its last task, and can be fetched by tasks with dispatch_worker_context.  On
+ * x86, workers that retire when idle call worker_stop, and workers started
+ * later call worker_start again.
+ *
+ * With a scratch_size, each worker owns a scratch arena that tasks allocate
+ * from with dispatch_scratch_alloc.  Scratch arenas are supported by the x86
+ * and FreeRTOS implementations.
+ *
+ * With an allocator, the dispatch queue allocates its own memory, the tasks
+ * it creates, its scratch arenas and the event counters of its waitable tasks
+ * from that allocator instead of the global allocator.  The allocator must
+ * outlive the queue.  FreeRTOS objects are allocated by FreeRTOS, and the
+ * x86 task lists use the C++ allocator.
+ *
+ * With a task_table_length, the tasks created by dispatch_queue_task_create
+ * are kept in a table of that many tasks, in one contiguous array, and the
+ * queue refers to them by 32-bit handles instead of pointers.  Workers then
+ * dequeue tasks from the table without following a pointer to a separate
+ * allocation.  Tasks from dispatch_task_create, including those made by
+ * dispatch_queue_function_add, do not use the table.  The task table is only
+ * supported by the x86 implementation.
+ *
+ * With a shard_count above one, the queue is split into that many deques,
+ * each with its own lock.  A task is added to the shorter of two randomly
+ * chosen shards, and workers take tasks from their home shard before
+ * scanning the others, so producers on many cores contend less for one
+ * lock.  Pinned workers scan the shards of workers sharing their last level
+ * cache first.  FIFO order only holds within a shard.  Scanning the shards
+ * costs more than an uncontended lock, so leave sharding off unless many
+ * producers run on as many cores.  Sharding is only supported by the x86
+ * implementation.
+ *
+ * With single_producer, tasks are added to a ring of the queue's length,
+ * rounded up to a power of two, without taking a lock.  Only one thread may
+ * add tasks, apart from the queue's own tasks, and dispatch_assert fails if
+ * another thread adds one.  When the ring is full, tasks are added to the
+ * queue as usual and may run out of order.  A single producer is only
+ * supported by the x86 implementation, and takes precedence over shards.
+ *
+ * \param length        Maximum number of tasks in the queue
+ * \param thread_count  Number of thread workers
+ * \param attr          Dispatch queue attributes
+ *
+ * @return              New dispatch queue object
+ */
+dispatch_queue_t* dispatch_queue_create_with_attr(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t* attr);
+
+/** Get the size of the storage needed to create a dispatch queue with
+ * dispatch_queue_create_with_storage
+ *
+ * \param length        Maximum number of tasks in the queue
+ * \param thread_count  Number of thread workers
+ * \param attr          Dispatch queue attributes
+ *
+ * @return              Size (in bytes) of the storage
+ */
+size_t dispatch_queue_storage_size(size_t length, size_t thread_count,
+                                   const dispatch_queue_attr_t* attr);
+
+/** Create a new dispatch queue in caller-provided storage
+ *
+ * Every structure of the dispatch queue, including the thread workers'
+ * stacks and scratch arenas, is placed in the storage.  Once the queue is
+ * created, tasks that are not waitable, reusable groups after their first
+ * wait, completion queues and graphs run without any heap calls.  Waitable
+ * tasks still allocate their counter when they are added.  The storage must
+ * be at least dispatch_queue_storage_size bytes, aligned like memory returned
+ * by malloc, and outlive the queue.  dispatch_queue_delete does not free the
+ * storage.
+ *
+ * On FreeRTOS, the queue and the worker tasks are only placed in the
+ * storage when configSUPPORT_STATIC_ALLOCATION is enabled.  On x86, only the
+ * queue object is placed in the storage, its task lists and threads still
+ * use the heap.
+ *
+ * \param length        Maximum number of tasks in the queue
+ * \param thread_count  Number of thread workers
+ * \param attr          Dispatch queue attributes
+ * \param storage       Storage for the dispatch queue
+ *
+ * @return              New dispatch queue object
+ */
+dispatch_queue_t* dispatch_queue_create_with_storage(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t* attr,
+    void* storage);
+
+/** Create a new logical dispatch queue backed by the process-wide worker pool
+ *
+ * A logical queue does not own any thread workers.  Its tasks are executed
+ * by a worker pool, sized to the hardware concurrency, that is shared by all
+ * logical queues in the process.  Each logical queue dispatches its own tasks
+ * in FIFO order and supports all of the wait functions.  The pool takes
+ * turns between logical queues with waiting tasks so no queue can starve the
+ * others.  Only available in the x86 implementation.
+ *
+ * \param length  Maximum number of tasks in the queue
+ *
+ * @return        New dispatch queue object
+ */
+dispatch_queue_t* dispatch_queue_create_shared(size_t length);
+
 /** Initialize a new dispatch queue
  *
  * \param ctx              Dispatch queue object
@@ -35,16 +227,57 @@ dispatch_queue_t* dispatch_queue_create(size_t length, size_t thread_count,
  */
 void dispatch_queue_init(dispatch_queue_t* ctx, size_t thread_priority);
 
+/** Start all of the dispatch queue's thread workers now
+ *
+ * Thread workers are started on demand when tasks are added, up to the
+ * thread_count specified when the dispatch queue was created.  Call this
+ * function to pay the worker startup cost up front, before latency-critical
+ * tasks are added.  On bare-metal, workers are always started by
+ * dispatch_queue_init so this function has no effect.
+ *
+ * \param ctx  Dispatch queue object
+ */
+void dispatch_queue_prewarm(dispatch_queue_t* ctx);
+
 /** Free memory allocated by dispatch_queue_create
+ *
+ * A shared dispatch queue performs its waiting tasks before it is deleted.
  *
  * \param ctx  Dispatch queue object
  */
 void dispatch_queue_delete(dispatch_queue_t* ctx);
 
+/** Create a new task for the dispatch queue
+ *
+ * The task is taken from the dispatch queue's task table if it has one with
+ * a free task, otherwise it is allocated from the dispatch queue's
+ * allocator.  The task is used and deleted like a task from
+ * dispatch_task_create, and is returned to the table when it is deleted.  It
+ * must be deleted before the dispatch queue.
+ *
+ * \param ctx       Dispatch queue object
+ * \param function  Function to perform, signature must be <tt>void(void*)</tt>
+ * \param argument  Function argument
+ * \param waitable  The task is waitable if TRUE, otherwise the task can not
+ * be waited on
+ *
+ * \return          Task object
+ */
+dispatch_task_t* dispatch_queue_task_create(dispatch_queue_t* ctx,
+                                            dispatch_function_t function,
+                                            void* argument, bool waitable);
+
 /** Add a task to the dispatch queue.  If the dispatch queue is full,
  * this function will block in the callers thread until it can be added to the
  * queue.
  *
+ * On the x86 implementation, a task added by one of the dispatch queue's own
+ * tasks is performed next by the same worker, ahead of the queue, while the
+ * data the tasks share is still in its cache.  The older tasks it displaces
+ * are left for idle workers to steal.  A task that waits on a task it added
+ * must use the wait API functions or dispatch_worker_blocking_begin, which
+ * give the added tasks back to the queue.
+ *
  * \param ctx   Dispatch queue object
  * \param task  Task object
  *
@@ -61,6 +294,57 @@ void dispatch_queue_task_add(dispatch_queue_t* ctx, dispatch_task_t* task);
  */
 void dispatch_queue_group_add(dispatch_queue_t* ctx, dispatch_group_t* group);
 
+/** Add a task to the dispatch queue that is bound to the group.  The task
+ * enters the group now and leaves it when it finishes, so a wait on the group
+ * also waits for the task.  See dispatch_group_enter.
+ *
+ * \param ctx    Dispatch queue object
+ * \param group  Group object
+ * \param task   Task object, must not be waitable
+ */
+void dispatch_queue_grouped_task_add(dispatch_queue_t* ctx,
+                                     dispatch_group_t* group,
+                                     dispatch_task_t* task);
+
+/** Creates a task that is bound to the group and adds it to the queue.  See
+ * dispatch_queue_grouped_task_add.
+ *
+ * \param ctx       Dispatch queue object
+ * \param group     Group object
+ * \param function  Function to perform, signature must be <tt>void(void*)</tt>
+ * \param argument  Function argument
+ */
+static inline void dispatch_queue_grouped_function_add(
+    dispatch_queue_t* ctx, dispatch_group_t* group,
+    dispatch_function_t function, void* argument) {
+  dispatch_queue_grouped_task_add(
+      ctx, group, dispatch_task_create(function, argument, false));
+}
+
+/** Perform a function once on every thread worker of the dispatch queue
+ *
+ * Use a broadcast for per-worker operations, like flushing thread-local
+ * buffers.  All of the queue's workers are started, and each worker performs
+ * the function at its next dequeue, ahead of the tasks waiting in the queue.
+ * A worker that is performing a task finishes it first, along with the rest
+ * of the batch of tasks it has taken from the queue, the other workers are
+ * not held up.  A broadcast on a shared queue is performed by the workers of
+ * the shared pool.  NOTE: on xcore and FreeRTOS, a worker holds one broadcast
+ * at a time, so this function blocks until each worker has taken the previous
+ * broadcast.
+ *
+ * \param ctx       Dispatch queue object
+ * \param function  Function to perform, signature must be <tt>void(void*)</tt>
+ * \param argument  Function argument
+ *
+ * \return          Waitable task object that completes when every worker has
+ * performed the function.  It must be waited on, but not from one of the
+ * queue's workers.
+ */
+dispatch_task_t* dispatch_queue_broadcast(dispatch_queue_t* ctx,
+                                          dispatch_function_t function,
+                                          void* argument);
+
 /** Creates a task and adds it to the the queue.  If the dispatch queue is full,
  * this function will block in the callers thread until it can be added to the
  * queue.
@@ -84,6 +368,62 @@ static inline dispatch_task_t* dispatch_queue_function_add(
   return task;
 }
 
+/** Add a blocking task to the dispatch queue.  See dispatch_task_set_blocking.
+ * The task counts towards the dispatch queue for dispatch_queue_wait.
+ *
+ * \param ctx   Dispatch queue object
+ * \param task  Task object
+ */
+static inline void dispatch_queue_blocking_add(dispatch_queue_t* ctx,
+                                               dispatch_task_t* task) {
+  dispatch_task_set_blocking(task, true);
+  dispatch_queue_task_add(ctx, task);
+}
+
+/** Inform the dispatch queue that the calling worker is about to block.
+ *
+ * In the x86 implementation, the dispatch queue compensates by starting a
+ * temporary worker if tasks are waiting.  The temporary worker exits when it
+ * is idle after dispatch_worker_blocking_end is called.  Has no effect when
+ * not called from a worker, or in the other implementations.
+ */
+void dispatch_worker_blocking_begin();
+
+/** Inform the dispatch queue that the calling worker is no longer blocked.
+ * Must be paired with dispatch_worker_blocking_begin.
+ */
+void dispatch_worker_blocking_end();
+
+/** Get the calling worker's context
+ *
+ * \return  The context returned by the worker_start hook of the calling
+ * worker's dispatch queue, NULL if the queue has no start hook or if not
+ * called from a worker.  On FreeRTOS, the result is only valid when called
+ * from a worker.
+ */
+void* dispatch_worker_context();
+
+/** Allocate temporary memory from the calling worker's scratch arena
+ *
+ * The memory is released when the task returns, so it must not be freed or
+ * used after that.  Allocation is a pointer bump, without locking.
+ *
+ * \param size  Size (in bytes) of the memory
+ *
+ * \return      Pointer to the memory, NULL if the arena does not have room,
+ * if the queue has no scratch arenas or if not called from a worker
+ */
+void* dispatch_scratch_alloc(size_t size);
+
+/** Get the most scratch memory that one task has allocated, for sizing the
+ * scratch arenas.  Tasks that are running are not included.
+ *
+ * \param ctx  Dispatch queue object
+ *
+ * \return     High watermark (in bytes) over all of the queue's workers
+ */
+size_t dispatch_queue_scratch_high_watermark(dispatch_queue_t* ctx);
+
 /** Wait synchronously in the caller's thread for the task to finish executing
  *
  * \param ctx   Dispatch queue object
@@ -92,6 +432,10 @@ static inline dispatch_task_t* dispatch_queue_function_add(
 void dispatch_queue_task_wait(dispatch_queue_t* ctx, dispatch_task_t* task);
 
 /** Wait synchronously in the caller's thread for the group to finish executing
+ *
+ * The wait includes the work that entered the group with dispatch_group_enter
+ * or dispatch_queue_grouped_task_add.  Only one thread may wait on a group at
+ * a time.
  *
  * \param ctx    Dispatch queue object
  * \param group  Group object, must be waitable
@@ -105,6 +449,157 @@ void dispatch_queue_group_wait(dispatch_queue_t* ctx, dispatch_group_t* group);
  */
 void dispatch_queue_wait(dispatch_queue_t* ctx);
 
+/** Wait synchronously in the caller's thread for any one of the tasks to
+ * finish executing
+ *
+ * The finished task is deleted and its entry in tasks is set to NULL, so the
+ * same array can be passed again to wait for the next task.  NULL entries
+ * are ignored but at least one entry must be a task.
+ *
+ * \param tasks  Array of task objects, must be waitable
+ * \param count  Number of entries in tasks
+ * \param index  Set to the index of the finished task
+ */
+void dispatch_wait_any(dispatch_task_t** tasks, size_t count, size_t* index);
+
+/** Wait synchronously in the caller's thread for all of the tasks to finish
+ * executing.  The tasks are deleted and their entries set to NULL.  NULL
+ * entries are ignored.
+ *
+ * \param tasks  Array of task objects, must be waitable
+ * \param count  Number of entries in tasks
+ */
+void dispatch_wait_all(dispatch_task_t** tasks, size_t count);
+
+/** Get the current time of the clock used for wait deadlines
+ *
+ * On bare-metal, the clock is derived from the 32-bit reference timer so
+ * deadlines must be less than 21 seconds away.
+ *
+ * \return  Current time in microseconds
+ */
+dispatch_time_t dispatch_time_now();
+
+/** Get the deadline that is timeout microseconds from now
+ *
+ * \param timeout  Timeout in microseconds
+ *
+ * \return         Deadline, DISPATCH_TIME_FOREVER if it would overflow
+ */
+static inline dispatch_time_t dispatch_time_after(dispatch_time_t timeout) {
+  dispatch_time_t now = dispatch_time_now();
+
+  if (timeout > DISPATCH_TIME_FOREVER - now) return DISPATCH_TIME_FOREVER;
+  return now + timeout;
+}
+
+/** Wait synchronously in the caller's thread for the task to finish
+ * executing, or for the deadline to pass
+ *
+ * The task is deleted if the wait completes.  If the deadline passes, the
+ * task is still valid and may be waited on again.
+ *
+ * \param ctx       Dispatch queue object
+ * \param task      Task object, must be waitable
+ * \param deadline  Deadline from dispatch_time_now, or DISPATCH_TIME_FOREVER
+ *
+ * \return          DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+dispatch_wait_status_t dispatch_queue_task_wait_until(dispatch_queue_t* ctx,
+                                                      dispatch_task_t* task,
+                                                      dispatch_time_t deadline);
+
+/** Wait synchronously in the caller's thread for the group to finish
+ * executing, or for the deadline to pass.  The group may be waited on again
+ * if the deadline passes.
+ *
+ * \param ctx       Dispatch queue object
+ * \param group     Group object, must be waitable
+ * \param deadline  Deadline from dispatch_time_now, or DISPATCH_TIME_FOREVER
+ *
+ * \return          DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+dispatch_wait_status_t dispatch_queue_group_wait_until(
+    dispatch_queue_t* ctx, dispatch_group_t* group, dispatch_time_t deadline);
+
+/** Wait synchronously in the caller's thread for all tasks to finish
+ * executing, or for the deadline to pass
+ *
+ * \param ctx       Dispatch queue object
+ * \param deadline  Deadline from dispatch_time_now, or DISPATCH_TIME_FOREVER
+ *
+ * \return          DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+dispatch_wait_status_t dispatch_queue_wait_until(dispatch_queue_t* ctx,
+                                                 dispatch_time_t deadline);
+
+/** Wait for the task with a timeout.  See dispatch_queue_task_wait_until.
+ *
+ * \param ctx      Dispatch queue object
+ * \param task     Task object, must be waitable
+ * \param timeout  Timeout in microseconds
+ *
+ * \return         DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+static inline dispatch_wait_status_t dispatch_queue_task_wait_for(
+    dispatch_queue_t* ctx, dispatch_task_t* task, dispatch_time_t timeout) {
+  return dispatch_queue_task_wait_until(ctx, task,
+                                        dispatch_time_after(timeout));
+}
+
+/** Wait for the group with a timeout.  See dispatch_queue_group_wait_until.
+ *
+ * \param ctx      Dispatch queue object
+ * \param group    Group object, must be waitable
+ * \param timeout  Timeout in microseconds
+ *
+ * \return         DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+static inline dispatch_wait_status_t dispatch_queue_group_wait_for(
+    dispatch_queue_t* ctx, dispatch_group_t* group, dispatch_time_t timeout) {
+  return dispatch_queue_group_wait_until(ctx, group,
+                                         dispatch_time_after(timeout));
+}
+
+/** Wait for all tasks with a timeout.  See dispatch_queue_wait_until.
+ *
+ * \param ctx      Dispatch queue object
+ * \param timeout  Timeout in microseconds
+ *
+ * \return         DISPATCH_WAIT_SUCCESS or DISPATCH_WAIT_TIMEOUT
+ */
+static inline dispatch_wait_status_t dispatch_queue_wait_for(
+    dispatch_queue_t* ctx, dispatch_time_t timeout) {
+  return dispatch_queue_wait_until(ctx, dispatch_time_after(timeout));
+}
+
+/** Check if the task has finished executing without blocking.  The task is
+ * deleted if it has finished.
+ *
+ * \param ctx   Dispatch queue object
+ * \param task  Task object, must be waitable
+ *
+ * \return      TRUE if the task has finished executing
+ */
+static inline bool dispatch_queue_task_poll(dispatch_queue_t* ctx,
+                                            dispatch_task_t* task) {
+  return (dispatch_queue_task_wait_until(ctx, task, dispatch_time_now()) ==
+          DISPATCH_WAIT_SUCCESS);
+}
+
+/** Check if the group has finished executing without blocking
+ *
+ * \param ctx    Dispatch queue object
+ * \param group  Group object, must be waitable
+ *
+ * \return       TRUE if the group has finished executing
+ */
+static inline bool dispatch_queue_group_poll(dispatch_queue_t* ctx,
+                                             dispatch_group_t* group) {
+  return (dispatch_queue_group_wait_until(ctx, group, dispatch_time_now()) ==
+          DISPATCH_WAIT_SUCCESS);
+}
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif  // __cplusplus
@@ -32,6 +32,27 @@ extern "C" {
 dispatch_task_t *dispatch_task_create(dispatch_function_t function,
                                       void *aargumentrg, bool waitable);
 
+/** Create a new task with an inline argument payload
+ *
+ * The payload is allocated in the same block as the task and is passed to
+ * the function as its argument, so the caller does not need to allocate and
+ * free a separate argument.  The payload is freed with the task, so the task
+ * can not be bound to a completion queue, which returns the argument of a
+ * task after deleting it.
+ *
+ * \param function  Function to perform, signature must be <tt>void(void*)</tt>
+ * \param size      Size (in bytes) of the payload
+ * \param payload   Set to the payload, for the caller to fill in before the
+ * task is added to a queue
+ * \param waitable  The task is waitable if TRUE, otherwise the task can not
+ * be waited on
+ *
+ * \return          Task object
+ */
+dispatch_task_t *dispatch_task_create_with_payload(dispatch_function_t function,
+                                                   size_t size, void **payload,
+                                                   bool waitable);
+
 /** Initialize a task
  *
  * \param task      Task object
@@ -43,6 +64,52 @@ dispatch_task_t *dispatch_task_create(dispatch_function_t function,
 void dispatch_task_init(dispatch_task_t *task, dispatch_function_t function,
                         void *argument, bool waitable);
 
+/** Mark the task as blocking
+ *
+ * Blocking tasks spend most of their time waiting on I/O, like disk or
+ * sockets.  The x86 implementation runs blocking tasks on a separate,
+ * elastic worker pool so they can not starve the dispatch queue's workers of
+ * CPU-bound work.  The other implementations run blocking tasks like any
+ * other task.
+ *
+ * \param task      Task object
+ * \param blocking  The task may block if TRUE
+ */
+void dispatch_task_set_blocking(dispatch_task_t *task, bool blocking);
+
+/** Cancel the task
+ *
+ * A cancelled task that has not started is skipped by the worker that
+ * dequeues it, waiters are still signalled as if it had run.  A task that has
+ * already started runs to completion unless its function checks
+ * dispatch_task_is_cancelled.  The task must not have been deleted, so
+ * non-waitable tasks can only be cancelled before they are added to a queue.
+ *
+ * \param task  Task object
+ */
+void dispatch_task_cancel(dispatch_task_t *task);
+
+/** Check if the task has been cancelled
+ *
+ * Long running task functions can call this periodically, with the task
+ * returned by dispatch_task_current, and return early.
+ *
+ * \param task  Task object
+ *
+ * \return      TRUE if the task has been cancelled
+ */
+bool dispatch_task_is_cancelled(const dispatch_task_t *task);
+
+/** Get the task being performed by the calling thread
+ *
+ * Gives a task function a handle to its own task, for example to check
+ * dispatch_task_is_cancelled, without passing the task in its argument.
+ * Implemented by each dispatch queue.
+ *
+ * \return  Task object, NULL if not called from a task performed by a queue
+ */
+dispatch_task_t *dispatch_task_current();
+
 /** Run the task in the caller's thread
  *
  * \param task  Task object
@@ -13,6 +13,16 @@ typedef unsigned spinlock_t;
  */
 spinlock_t *spinlock_create();
 
+/** Initialize a software lock in caller-provided memory.
+ *
+ *  This function initializes a software lock without allocating, so it can
+ *  be embedded in another structure.  A lock initialized this way must not be
+ *  passed to spinlock_delete.
+ *
+ *  \param lock   the software lock to initialize.
+ */
+void spinlock_init(spinlock_t *lock);
+
 /** Try and acquire a software lock.
  *
  *  This function tries to acquire a lock for the current logical core.
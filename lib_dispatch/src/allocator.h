@@ -0,0 +1,37 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_ALLOCATOR_INTERNAL_H_
+#define DISPATCH_ALLOCATOR_INTERNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dispatch_allocator.h"
+#include "dispatch_task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Returns the allocator, or the global allocator if it is NULL.  Objects keep
+// the resolved allocator so they are freed to the one they came from.
+const dispatch_allocator_t *allocator_resolve(
+    const dispatch_allocator_t *allocator);
+
+// Allocates from the allocator, or from the global allocator if it is NULL
+void *allocator_malloc(const dispatch_allocator_t *allocator, size_t size);
+
+// Frees to the allocator, or to the global allocator if it is NULL
+void allocator_free(const dispatch_allocator_t *allocator, void *ptr);
+
+// Creates a task with memory from the allocator, freed by
+// dispatch_task_delete
+dispatch_task_t *allocator_task_create(const dispatch_allocator_t *allocator,
+                                       dispatch_function_t function,
+                                       void *argument, bool waitable);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_ALLOCATOR_INTERNAL_H_
@@ -0,0 +1,48 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_COMPLETION_RING_H_
+#define DISPATCH_COMPLETION_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dispatch_allocator.h"
+#include "dispatch_completion.h"
+#include "dispatch_task.h"
+
+typedef struct completion_cell_struct completion_cell_t;
+struct completion_cell_struct {
+  size_t sequence;  // position the cell is ready for
+  dispatch_task_t *task;
+};
+
+// bounded multi-producer ring, each cell's sequence number tells producers
+// and the consumer whose turn it is so neither needs a lock
+struct dispatch_completion_struct {
+  completion_cell_t *cells;
+  size_t mask;              // number of cells minus 1
+  size_t enqueue_position;  // next position to push
+  size_t dequeue_position;  // next position to reap
+  uint32_t events;          // incremented after every push, for waiters
+  uint32_t waiting;         // non-zero while the consumer may be blocked
+  uint32_t producers;       // number of workers in completion_ring_push
+  const dispatch_allocator_t *allocator;  // allocates the cells and the ring
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Pushes a finished task, called by the workers
+void completion_ring_push(dispatch_completion_t *completion,
+                          dispatch_task_t *task);
+
+// Wakes the consumer if it is blocked in dispatch_completion_wait, called by
+// completion_ring_push and implemented by each dispatch queue
+void completion_ring_notify(dispatch_completion_t *completion);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_COMPLETION_RING_H_
@@ -6,22 +6,28 @@
 condition_variable_t* condition_variable_create() {
   condition_variable_t* cv = dispatch_malloc(sizeof(condition_variable_t));
 
-  cv->waiters = NULL;
-  cv->lock = dispatch_spinlock_create();
+  condition_variable_init(cv);
 
   return cv;
 }
 
+void condition_variable_init(condition_variable_t* cv) {
+  dispatch_assert(cv);
+
+  cv->waiters = NULL;
+  spinlock_init(&cv->lock);
+}
+
 bool condition_variable_wait(condition_variable_t* cv, dispatch_mutex_t lock,
                              chanend_t dest) {
   dispatch_assert(cv);
 
-  dispatch_spinlock_get(cv->lock);
+  spinlock_acquire(&cv->lock);
   condition_node_t waiter;
   waiter.cend = dest;
   waiter.next = cv->waiters;
   cv->waiters = &waiter;
-  dispatch_spinlock_put(cv->lock);
+  spinlock_release(&cv->lock);
 
   // release lock while we wait
   dispatch_mutex_put(lock);
@@ -50,7 +56,7 @@ static void condition_variable_send(chanend_t source, chanend_t dest,
 void condition_variable_signal(condition_variable_t* cv, chanend_t source) {
   dispatch_assert(cv);
 
-  dispatch_spinlock_get(cv->lock);
+  spinlock_acquire(&cv->lock);
 
   // send the next waiter the signal event
   if (cv->waiters != NULL) {
@@ -58,13 +64,13 @@ void condition_variable_signal(condition_variable_t* cv, chanend_t source) {
     cv->waiters = cv->waiters->next;
   }
 
-  dispatch_spinlock_put(cv->lock);
+  spinlock_release(&cv->lock);
 }
 
 void condition_variable_broadcast(condition_variable_t* cv, chanend_t source) {
   dispatch_assert(cv);
 
-  dispatch_spinlock_get(cv->lock);
+  spinlock_acquire(&cv->lock);
 
   // send all waiter the signal event
   while (cv->waiters != NULL) {
@@ -72,13 +78,13 @@ void condition_variable_broadcast(condition_variable_t* cv, chanend_t source) {
     cv->waiters = cv->waiters->next;
   }
 
-  dispatch_spinlock_put(cv->lock);
+  spinlock_release(&cv->lock);
 }
 
 void condition_variable_terminate(condition_variable_t* cv, chanend_t source) {
   dispatch_assert(cv);
 
-  dispatch_spinlock_get(cv->lock);
+  spinlock_acquire(&cv->lock);
 
   // send all waiter the terminate event
   while (cv->waiters != NULL) {
@@ -86,12 +92,18 @@ void condition_variable_terminate(condition_variable_t* cv, chanend_t source) {
     cv->waiters = cv->waiters->next;
   }
 
-  dispatch_spinlock_put(cv->lock);
+  spinlock_release(&cv->lock);
+}
+
+void condition_variable_deinit(condition_variable_t* cv) {
+  dispatch_assert(cv);
+
+  // NOTE: the embedded lock has nothing to free
 }
 
 void condition_variable_delete(condition_variable_t* cv) {
   dispatch_assert(cv);
 
-  dispatch_spinlock_delete(cv->lock);
+  condition_variable_deinit(cv);
   dispatch_free(cv);
 }
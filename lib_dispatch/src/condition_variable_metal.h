@@ -8,6 +8,7 @@
 #include <xcore/lock.h>
 
 #include "dispatch_config.h"
+#include "spinlock.h"
 
 typedef struct condition_node_struct condition_node_t;
 struct condition_node_struct {
@@ -17,16 +18,20 @@ struct condition_node_struct {
 
 typedef struct condition_variable_struct condition_variable_t;
 struct condition_variable_struct {
-  dispatch_spinlock_t lock;
+  // NOTE: the lock is embedded rather than created, so a condition variable
+  //       placed in caller storage does not allocate
+  spinlock_t lock;
   condition_node_t* waiters;  // linked list
 };
 
 condition_variable_t* condition_variable_create();
+void condition_variable_init(condition_variable_t* cv);
 bool condition_variable_wait(condition_variable_t* cv, dispatch_mutex_t lock,
                              chanend_t dest);
 void condition_variable_signal(condition_variable_t* cv, chanend_t source);
 void condition_variable_broadcast(condition_variable_t* cv, chanend_t source);
 void condition_variable_terminate(condition_variable_t* cv, chanend_t source);
+void condition_variable_deinit(condition_variable_t* cv);
 void condition_variable_delete(condition_variable_t* cv);
 
 #endif  // DISPATCH_CONDITION_VARIABLE_METAL_H_
\ No newline at end of file
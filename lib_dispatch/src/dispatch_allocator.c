@@ -0,0 +1,52 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#include "allocator.h"
+#include "dispatch_config.h"
+
+DISPATCH_ALLOCATOR_FUNCTION
+static void *default_malloc(void *context, size_t size) {
+  return dispatch_malloc(size);
+}
+
+DISPATCH_ALLOCATOR_FUNCTION
+static void default_free(void *context, void *ptr) { dispatch_free(ptr); }
+
+// calls the allocation functions from dispatch_config.h
+static const dispatch_allocator_t default_allocator = {default_malloc,
+                                                       default_free, NULL};
+
+static const dispatch_allocator_t *global_allocator = &default_allocator;
+
+void dispatch_allocator_set(const dispatch_allocator_t *allocator) {
+  if (allocator) {
+    dispatch_assert(allocator->malloc);
+    dispatch_assert(allocator->free);
+  } else {
+    allocator = &default_allocator;
+  }
+
+  dispatch_printf("dispatch_allocator_set: %u\n", (size_t)allocator);
+
+  __atomic_store_n(&global_allocator, allocator, __ATOMIC_RELEASE);
+}
+
+const dispatch_allocator_t *dispatch_allocator_get() {
+  return __atomic_load_n(&global_allocator, __ATOMIC_ACQUIRE);
+}
+
+const dispatch_allocator_t *allocator_resolve(
+    const dispatch_allocator_t *allocator) {
+  return allocator ? allocator : dispatch_allocator_get();
+}
+
+void *allocator_malloc(const dispatch_allocator_t *allocator, size_t size) {
+  allocator = allocator_resolve(allocator);
+
+  return allocator->malloc(allocator->context, size);
+}
+
+void allocator_free(const dispatch_allocator_t *allocator, void *ptr) {
+  allocator = allocator_resolve(allocator);
+
+  allocator->free(allocator->context, ptr);
+}
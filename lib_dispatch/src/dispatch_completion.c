@@ -0,0 +1,155 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#include "dispatch_completion.h"
+
+#include <stdint.h>
+
+#include "allocator.h"
+#include "completion_ring.h"
+#include "dispatch_config.h"
+#include "dispatch_types.h"
+
+dispatch_completion_t *dispatch_completion_create(size_t length) {
+  dispatch_completion_t *completion;
+  size_t cell_count = 1;
+
+  dispatch_assert(length > 0);
+
+  dispatch_printf("dispatch_completion_create: length=%d\n", length);
+
+  // the cell count is a power of 2 so positions can be masked
+  while (cell_count < length) cell_count <<= 1;
+
+  const dispatch_allocator_t *allocator = allocator_resolve(NULL);
+  completion = allocator_malloc(allocator, sizeof(dispatch_completion_t));
+  completion->cells =
+      allocator_malloc(allocator, sizeof(completion_cell_t) * cell_count);
+  completion->allocator = allocator;
+
+  for (size_t i = 0; i < cell_count; i++) {
+    completion->cells[i].sequence = i;
+    completion->cells[i].task = NULL;
+  }
+  completion->mask = cell_count - 1;
+  completion->enqueue_position = 0;
+  completion->dequeue_position = 0;
+  completion->events = 0;
+  completion->waiting = 0;
+  completion->producers = 0;
+
+  return completion;
+}
+
+void dispatch_completion_delete(dispatch_completion_t *completion) {
+  dispatch_assert(completion);
+  dispatch_assert(completion->cells);
+
+  dispatch_printf("dispatch_completion_delete: %u\n", (size_t)completion);
+
+  void *argument;
+
+  // wait for workers that are still notifying, then delete the tasks that
+  // were never reaped
+  while (__atomic_load_n(&completion->producers, __ATOMIC_ACQUIRE)) continue;
+  while (dispatch_completion_poll(completion, &argument, 1)) continue;
+
+  allocator_free(completion->allocator, completion->cells);
+  allocator_free(completion->allocator, completion);
+}
+
+void dispatch_task_set_completion(dispatch_task_t *task,
+                                  dispatch_completion_t *completion) {
+  dispatch_assert(task);
+  dispatch_assert(!task->waitable);
+  // NOTE: reaping deletes the task, which would free the payload before the
+  //       caller reads the argument returned for it
+  dispatch_assert(!task->payload);
+
+  task->completion = completion;
+}
+
+void completion_ring_push(dispatch_completion_t *completion,
+                          dispatch_task_t *task) {
+  completion_cell_t *cell;
+
+  // NOTE: the consumer may reap the task as soon as it is published, so the
+  //       completion queue is referenced until the push is finished
+  __atomic_add_fetch(&completion->producers, 1, __ATOMIC_ACQUIRE);
+
+  size_t position =
+      __atomic_load_n(&completion->enqueue_position, __ATOMIC_RELAXED);
+
+  for (;;) {
+    cell = &completion->cells[position & completion->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+    if (diff == 0) {
+      // the cell is free, claim its position
+      if (__atomic_compare_exchange_n(&completion->enqueue_position, &position,
+                                      position + 1, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        break;
+    } else {
+      if (diff < 0) {
+        // the cell's last task is still being reaped, the consumer has
+        // claimed it unless more tasks are unreaped than the ring holds
+        size_t dequeue_position =
+            __atomic_load_n(&completion->dequeue_position, __ATOMIC_RELAXED);
+        dispatch_assert(position - dequeue_position <= completion->mask);
+      }
+      // another worker claimed the position, reload it
+      position =
+          __atomic_load_n(&completion->enqueue_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  // publish the task to the consumer
+  cell->task = task;
+  __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&completion->events, 1, __ATOMIC_SEQ_CST);
+  completion_ring_notify(completion);
+
+  __atomic_sub_fetch(&completion->producers, 1, __ATOMIC_RELEASE);
+}
+
+size_t dispatch_completion_poll(dispatch_completion_t *completion,
+                                void **arguments, size_t count) {
+  dispatch_assert(completion);
+  dispatch_assert(arguments);
+
+  completion_cell_t *cell;
+  size_t reaped = 0;
+  size_t position =
+      __atomic_load_n(&completion->dequeue_position, __ATOMIC_RELAXED);
+
+  while (reaped < count) {
+    cell = &completion->cells[position & completion->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if (diff == 0) {
+      // the cell holds a finished task, claim its position
+      if (__atomic_compare_exchange_n(&completion->dequeue_position, &position,
+                                      position + 1, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        dispatch_task_t *task = cell->task;
+        // hand the cell back to the producers for the next lap
+        __atomic_store_n(&cell->sequence, position + completion->mask + 1,
+                         __ATOMIC_RELEASE);
+        arguments[reaped++] = task->argument;
+        dispatch_task_delete(task);
+        position++;
+      }
+    } else if (diff < 0) {
+      // the ring is empty
+      break;
+    } else {
+      // another thread reaped this position
+      position =
+          __atomic_load_n(&completion->dequeue_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  return reaped;
+}
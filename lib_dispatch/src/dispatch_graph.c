@@ -0,0 +1,231 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#include "dispatch_graph.h"
+
+#include "allocator.h"
+#include "dispatch_config.h"
+#include "dispatch_types.h"
+#include "event_counter.h"
+
+typedef struct dispatch_graph_node_struct dispatch_graph_node_t;
+
+struct dispatch_graph_node_struct {
+  dispatch_task_t task;          // performs the node, owned by the graph
+  dispatch_function_t function;  // the function to perform
+  void *argument;                // argument to pass to the function
+  dispatch_graph_t *graph;       // graph the node belongs to
+  size_t *dependencies;          // captured dependencies, freed by finalize
+  size_t dependency_count;       // number of nodes this node depends on
+  size_t pending;                // dependencies not yet finished this launch
+  size_t *successors;            // nodes that depend on this node
+  size_t successor_count;        // number of successors
+};
+
+struct dispatch_graph_struct {
+  size_t length;                 // maximum number of nodes in the graph
+  size_t count;                  // number of nodes captured
+  bool finalized;                // capture has ended
+  dispatch_graph_node_t *nodes;  // array of nodes
+  size_t *roots;                 // nodes without dependencies
+  size_t root_count;             // number of roots
+  size_t *edges;                 // storage for the roots and successors
+  event_counter_t *counter;      // counts the nodes not yet finished
+  dispatch_queue_t *queue;       // queue the graph was launched on
+  bool cancelled;                // skip the nodes until the wait returns
+  const dispatch_allocator_t *allocator;  // allocates the graph's memory
+};
+
+// Performs the node and adds the successors that became ready to the queue.
+// A cancelled node is skipped but still releases its successors, so the
+// wait returns.
+DISPATCH_TASK_FUNCTION
+static void graph_node_run(void *argument) {
+  dispatch_graph_node_t *node = (dispatch_graph_node_t *)argument;
+  dispatch_graph_t *graph = node->graph;
+
+  // every dependency has finished, so the pending count is rearmed for the
+  // next launch here instead of by the launch itself
+  __atomic_store_n(&node->pending, node->dependency_count, __ATOMIC_RELAXED);
+
+  if (!__atomic_load_n(&graph->cancelled, __ATOMIC_RELAXED))
+    node->function(node->argument);
+
+  for (size_t i = 0; i < node->successor_count; i++) {
+    dispatch_graph_node_t *successor = &graph->nodes[node->successors[i]];
+    if (__atomic_sub_fetch(&successor->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+      dispatch_queue_task_add(graph->queue, &successor->task);
+    }
+  }
+
+  // NOTE: the waiter may delete the graph once the last node signals, so the
+  //       node is not touched after this
+  event_counter_signal(graph->counter);
+}
+
+dispatch_graph_t *dispatch_graph_create(size_t length) {
+  dispatch_graph_t *graph;
+
+  dispatch_assert(length > 0);
+
+  dispatch_printf("dispatch_graph_create: length=%d\n", length);
+
+  const dispatch_allocator_t *allocator = allocator_resolve(NULL);
+  graph = allocator_malloc(allocator, sizeof(dispatch_graph_t));
+  graph->allocator = allocator;
+
+  graph->length = length;
+  graph->count = 0;
+  graph->finalized = false;
+  graph->nodes =
+      allocator_malloc(allocator, sizeof(dispatch_graph_node_t) * length);
+  graph->roots = NULL;
+  graph->root_count = 0;
+  graph->edges = NULL;
+  graph->counter = event_counter_create(0, allocator);
+  graph->queue = NULL;
+  graph->cancelled = false;
+
+  return graph;
+}
+
+size_t dispatch_graph_function_add(dispatch_graph_t *graph,
+                                   dispatch_function_t function,
+                                   void *argument, const size_t *dependencies,
+                                   size_t dependency_count) {
+  dispatch_assert(graph);
+  dispatch_assert(!graph->finalized);
+  dispatch_assert(graph->count < graph->length);
+  dispatch_assert(function);
+
+  size_t index = graph->count;
+  dispatch_graph_node_t *node = &graph->nodes[index];
+
+  dispatch_printf("dispatch_graph_function_add: %u   index=%u\n",
+                  (size_t)graph, index);
+
+  dispatch_task_init(&node->task, graph_node_run, node, false);
+  node->task.persistent = true;
+  node->function = function;
+  node->argument = argument;
+  node->graph = graph;
+  node->dependencies = NULL;
+  node->dependency_count = dependency_count;
+  node->pending = dependency_count;
+  node->successors = NULL;
+  node->successor_count = 0;
+
+  if (dependency_count) {
+    dispatch_assert(dependencies);
+    node->dependencies =
+        allocator_malloc(graph->allocator, sizeof(size_t) * dependency_count);
+    for (size_t i = 0; i < dependency_count; i++) {
+      // dependencies must be captured first, so the graph is acyclic
+      dispatch_assert(dependencies[i] < index);
+      node->dependencies[i] = dependencies[i];
+      graph->nodes[dependencies[i]].successor_count++;
+    }
+  } else {
+    graph->root_count++;
+  }
+
+  graph->count++;
+
+  return index;
+}
+
+void dispatch_graph_finalize(dispatch_graph_t *graph) {
+  dispatch_assert(graph);
+  dispatch_assert(!graph->finalized);
+
+  dispatch_printf("dispatch_graph_finalize: %u   count=%u\n", (size_t)graph,
+                  graph->count);
+
+  size_t edge_count = graph->root_count;
+  size_t *edges;
+
+  for (size_t i = 0; i < graph->count; i++) {
+    edge_count += graph->nodes[i].successor_count;
+  }
+
+  // the roots and the successor lists are packed in one allocation
+  graph->edges =
+      allocator_malloc(graph->allocator, sizeof(size_t) * edge_count);
+  graph->roots = graph->edges;
+  edges = graph->edges + graph->root_count;
+  for (size_t i = 0; i < graph->count; i++) {
+    graph->nodes[i].successors = edges;
+    edges += graph->nodes[i].successor_count;
+    graph->nodes[i].successor_count = 0;
+  }
+
+  // fill the successor lists from the captured dependencies
+  size_t root_count = 0;
+  for (size_t i = 0; i < graph->count; i++) {
+    dispatch_graph_node_t *node = &graph->nodes[i];
+    if (node->dependency_count == 0) graph->roots[root_count++] = i;
+    for (size_t j = 0; j < node->dependency_count; j++) {
+      dispatch_graph_node_t *dependency = &graph->nodes[node->dependencies[j]];
+      dependency->successors[dependency->successor_count++] = i;
+    }
+    if (node->dependencies)
+      allocator_free(graph->allocator, node->dependencies);
+    node->dependencies = NULL;
+  }
+
+  graph->finalized = true;
+}
+
+void dispatch_graph_delete(dispatch_graph_t *graph) {
+  dispatch_assert(graph);
+  dispatch_assert(graph->nodes);
+
+  dispatch_printf("dispatch_graph_delete: %u\n", (size_t)graph);
+
+  for (size_t i = 0; i < graph->count; i++) {
+    if (graph->nodes[i].dependencies)
+      allocator_free(graph->allocator, graph->nodes[i].dependencies);
+  }
+  if (graph->edges) allocator_free(graph->allocator, graph->edges);
+  event_counter_delete(graph->counter);
+  allocator_free(graph->allocator, graph->nodes);
+  allocator_free(graph->allocator, graph);
+}
+
+void dispatch_queue_graph_launch(dispatch_queue_t *ctx,
+                                 dispatch_graph_t *graph) {
+  dispatch_assert(ctx);
+  dispatch_assert(graph);
+  dispatch_assert(graph->finalized);
+  dispatch_assert(graph->count > 0);
+
+  dispatch_printf("dispatch_queue_graph_launch: %u   graph=%u\n", (size_t)ctx,
+                  (size_t)graph);
+
+  graph->queue = ctx;
+  event_counter_reset(graph->counter, graph->count);
+
+  for (size_t i = 0; i < graph->root_count; i++) {
+    dispatch_queue_task_add(ctx, &graph->nodes[graph->roots[i]].task);
+  }
+}
+
+void dispatch_queue_graph_wait(dispatch_queue_t *ctx, dispatch_graph_t *graph) {
+  dispatch_assert(graph);
+  dispatch_assert(graph->queue == ctx);
+
+  dispatch_printf("dispatch_queue_graph_wait: %u   graph=%u\n", (size_t)ctx,
+                  (size_t)graph);
+
+  event_counter_wait(graph->counter);
+  __atomic_store_n(&graph->cancelled, false, __ATOMIC_RELAXED);
+}
+
+void dispatch_graph_cancel(dispatch_graph_t *graph) {
+  dispatch_assert(graph);
+
+  dispatch_printf("dispatch_graph_cancel: %u\n", (size_t)graph);
+
+  // NOTE: like dispatch_task_cancel, a node that has already read the flag
+  //       is allowed to miss the cancel
+  __atomic_store_n(&graph->cancelled, true, __ATOMIC_RELAXED);
+}
@@ -5,18 +5,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
 #include "dispatch_config.h"
+#include "dispatch_queue.h"
 #include "dispatch_types.h"
+#include "event_counter.h"
 
 dispatch_group_t *dispatch_group_create(size_t length, bool waitable) {
   dispatch_group_t *group;
 
   dispatch_printf("dispatch_group_create: length=%d\n", length);
 
-  group = dispatch_malloc(sizeof(dispatch_group_t));
+  const dispatch_allocator_t *allocator = allocator_resolve(NULL);
+  group = allocator_malloc(allocator, sizeof(dispatch_group_t));
+  group->allocator = allocator;
 
-  group->length = length;
-  group->tasks = dispatch_malloc(sizeof(dispatch_task_t *) * length);
+  // the first chunk is allocated up front, the others as the group grows
+  group->length = length ? length : 1;
+  for (int i = 0; i < GROUP_CHUNK_COUNT; i++) {
+    group->chunks[i] = NULL;
+  }
+  if (length) {
+    group->chunks[0] =
+        allocator_malloc(allocator, sizeof(dispatch_task_t *) * length);
+  }
 
   // initialize the queue
   dispatch_group_init(group, waitable);
@@ -28,6 +40,9 @@ void dispatch_group_init(dispatch_group_t *group, bool waitable) {
   dispatch_assert(group);
 
   group->waitable = waitable;
+  group->reusable = false;
+  group->pending = 0;
+  group->counter = NULL;
   group->count = 0;
 }
 
@@ -36,19 +51,173 @@ dispatch_task_t *dispatch_group_function_add(dispatch_group_t *group,
                                              void *argument) {
   dispatch_task_t *task;
 
-  task = dispatch_task_create(function, argument, group->waitable);
+  task = allocator_task_create(group->allocator, function, argument,
+                               group->waitable);
   dispatch_group_task_add(group, task);
 
   return task;
 }
 
+// Allocates a chunk of the group's task array, returns the chunk that was
+// installed first if another thread allocated it concurrently
+static dispatch_task_t **group_chunk_alloc(dispatch_group_t *group,
+                                           size_t chunk) {
+  dispatch_task_t **expected = NULL;
+  dispatch_task_t **tasks = allocator_malloc(
+      group->allocator, sizeof(dispatch_task_t *) * (group->length << chunk));
+
+  if (!__atomic_compare_exchange_n(&group->chunks[chunk], &expected, tasks,
+                                   false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    allocator_free(group->allocator, tasks);
+    tasks = expected;
+  }
+
+  return tasks;
+}
+
 void dispatch_group_task_add(dispatch_group_t *group, dispatch_task_t *task) {
   dispatch_assert(group);
-  dispatch_assert(group->count < group->length);
+  dispatch_assert(task);
 
   task->waitable = group->waitable;
-  group->tasks[group->count] = task;
-  group->count++;
+  task->persistent = group->reusable;
+  // the tasks of a waitable group leave it when they finish
+  if (group->waitable) task->group = group;
+
+  // reserve a slot, other threads may be adding tasks concurrently
+  size_t index = __atomic_fetch_add(&group->count, 1, __ATOMIC_RELAXED);
+  size_t offset;
+  size_t chunk = group_chunk(group, index, &offset);
+  dispatch_assert(chunk < GROUP_CHUNK_COUNT);
+
+  dispatch_task_t **tasks =
+      __atomic_load_n(&group->chunks[chunk], __ATOMIC_ACQUIRE);
+  if (!tasks) tasks = group_chunk_alloc(group, chunk);
+  tasks[offset] = task;
+}
+
+void dispatch_group_set_reusable(dispatch_group_t *group, bool reusable) {
+  dispatch_assert(group);
+
+  group->reusable = reusable;
+  for (int i = 0; i < group->count; i++) {
+    group_task(group, i)->persistent = reusable;
+  }
+}
+
+void dispatch_group_reset(dispatch_group_t *group) {
+  dispatch_assert(group);
+  dispatch_assert(group->reusable);
+  dispatch_assert(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) == 0);
+
+  dispatch_printf("dispatch_group_reset: %u\n", (size_t)group);
+
+  for (int i = 0; i < group->count; i++) {
+    group_task(group, i)->cancelled = false;
+  }
+}
+
+void dispatch_group_enter(dispatch_group_t *group) {
+  dispatch_assert(group);
+
+  __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+}
+
+void dispatch_group_leave(dispatch_group_t *group) {
+  dispatch_assert(group);
+
+  size_t pending = __atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+  dispatch_assert((pending & ~GROUP_WAITING) != GROUP_WAITING - 1);
+
+  // NOTE: the waiter can not return before it is signalled once it has set
+  //       the flag, so only the last leave with a waiter touches the group
+  //       after the count reaches zero
+  if (pending == GROUP_WAITING) {
+    __atomic_fetch_and(&group->pending, ~GROUP_WAITING, __ATOMIC_ACQ_REL);
+    event_counter_signal(group->counter);
+  }
+}
+
+void dispatch_queue_grouped_task_add(dispatch_queue_t *ctx,
+                                     dispatch_group_t *group,
+                                     dispatch_task_t *task) {
+  dispatch_assert(group);
+  dispatch_assert(task);
+  dispatch_assert(!task->waitable);
+
+  dispatch_group_enter(group);
+  task->group = group;
+  dispatch_queue_task_add(ctx, task);
+}
+
+void dispatch_queue_group_wait(dispatch_queue_t *ctx, dispatch_group_t *group) {
+  dispatch_queue_group_wait_until(ctx, group, DISPATCH_TIME_FOREVER);
+}
+
+// Blocks until the group's pending count is zero, returns false if the
+// deadline passed
+static bool group_counter_wait(dispatch_group_t *group,
+                               dispatch_time_t deadline) {
+  size_t pending = __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+
+  if (pending == 0) return true;
+  if (deadline != DISPATCH_TIME_FOREVER && deadline <= dispatch_time_now())
+    return false;
+
+  // the counter is armed before the flag is set, the last leave signals it
+  if (!group->counter)
+    group->counter = event_counter_create(1, group->allocator);
+  event_counter_reset(group->counter, 1);
+  pending = __atomic_fetch_or(&group->pending, GROUP_WAITING, __ATOMIC_ACQ_REL);
+  if (pending == 0) {
+    // the group finished before the flag was set, nothing will signal
+    __atomic_fetch_and(&group->pending, ~GROUP_WAITING, __ATOMIC_ACQ_REL);
+    return true;
+  }
+
+  if (event_counter_wait_until(group->counter, deadline)) return true;
+
+  // withdraw the flag, unless the last leave has already claimed it
+  pending = __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+  while ((pending & GROUP_WAITING) && (pending != GROUP_WAITING)) {
+    if (__atomic_compare_exchange_n(&group->pending, &pending,
+                                    pending & ~GROUP_WAITING, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return false;
+  }
+  // the signal is on its way
+  event_counter_wait(group->counter);
+  return true;
+}
+
+dispatch_wait_status_t dispatch_queue_group_wait_until(
+    dispatch_queue_t *ctx, dispatch_group_t *group, dispatch_time_t deadline) {
+  dispatch_assert(group);
+  dispatch_assert(group->waitable);
+
+  dispatch_printf("dispatch_queue_group_wait: %u   group=%u\n", (size_t)ctx,
+                  (size_t)group);
+
+  if (!group_counter_wait(group, deadline)) return DISPATCH_WAIT_TIMEOUT;
+  // a reusable group keeps its tasks
+  if (group->reusable) return DISPATCH_WAIT_SUCCESS;
+  // the contract is that the dispatch queue must delete waitable tasks
+  for (int i = 0; i < group->count; i++) {
+    dispatch_task_delete(group_task(group, i));
+  }
+  group->count = 0;
+
+  return DISPATCH_WAIT_SUCCESS;
+}
+
+void dispatch_group_cancel(dispatch_group_t *group) {
+  dispatch_assert(group);
+
+  dispatch_printf("dispatch_group_cancel: %u\n", (size_t)group);
+
+  for (int i = 0; i < group->count; i++) {
+    dispatch_task_cancel(group_task(group, i));
+  }
 }
 
 void dispatch_group_perform(dispatch_group_t *group) {
@@ -58,15 +227,22 @@ void dispatch_group_perform(dispatch_group_t *group) {
 
   // call group in current thread
   for (int i = 0; i < group->count; i++) {
-    dispatch_task_t *task = group->tasks[i];
+    dispatch_task_t *task = group_task(group, i);
     dispatch_task_perform(task);
   }
 }
 
 void dispatch_group_delete(dispatch_group_t *group) {
   dispatch_assert(group);
-  dispatch_assert(group->tasks);
 
-  dispatch_free(group->tasks);
-  dispatch_free(group);
+  if (group->reusable) {
+    for (int i = 0; i < group->count; i++) {
+      dispatch_task_delete(group_task(group, i));
+    }
+  }
+  if (group->counter) event_counter_delete(group->counter);
+  for (int i = 0; i < GROUP_CHUNK_COUNT; i++) {
+    if (group->chunks[i]) allocator_free(group->allocator, group->chunks[i]);
+  }
+  allocator_free(group->allocator, group);
 }
@@ -1,56 +1,224 @@
 // Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
 // XMOS Public License: Version 1
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <ctime>
 #include <deque>
 #include <mutex>
+#include <new>
 #include <thread>
 #include <vector>
 
+#include "allocator.h"
+#include "completion_ring.h"
 #include "dispatch_config.h"
 #include "dispatch_group.h"
 #include "dispatch_queue.h"
 #include "dispatch_task.h"
 #include "dispatch_types.h"
+#include "event_counter.h"
+#include "scratch_arena.h"
+#include "topology_host.h"
+#include "worker_host.h"
+
+//***********************
+//***********************
+//***********************
+// Allocation
+//***********************
+//***********************
+//***********************
+
+// Returns the first address in the memory that is aligned for T
+template <typename T>
+static void *align_for(void *memory) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+  return reinterpret_cast<void *>((address + alignof(T) - 1) &
+                                  ~(uintptr_t)(alignof(T) - 1));
+}
+
+// Creates an object with memory from the allocator
+template <typename T, typename... Args>
+static T *allocator_new(const dispatch_allocator_t *allocator, Args... args) {
+  if (alignof(T) <= alignof(std::max_align_t))
+    return new (allocator_malloc(allocator, sizeof(T))) T(args...);
+
+  // NOTE: the allocator only aligns like malloc, so objects aligned to a
+  //       cache line are over-allocated and the allocation is kept in front
+  //       of the object
+  void *memory = allocator_malloc(allocator, sizeof(T) + alignof(T));
+  void *place = align_for<T>(static_cast<void **>(memory) + 1);
+  static_cast<void **>(place)[-1] = memory;
+  return new (place) T(args...);
+}
+
+// Destroys an object made by allocator_new
+template <typename T>
+static void allocator_delete(const dispatch_allocator_t *allocator, T *object) {
+  object->~T();
+  if (alignof(T) <= alignof(std::max_align_t)) {
+    allocator_free(allocator, object);
+  } else {
+    allocator_free(allocator, reinterpret_cast<void **>(object)[-1]);
+  }
+}
 
 //***********************
 //***********************
 //***********************
-// EventCounter class
+// TaskCompletion classes
 //***********************
 //***********************
 //***********************
-class EventCounter {
+class TaskCompletion {
+ public:
+  virtual ~TaskCompletion() {}
+
+  // called by the worker after the task has been performed
+  virtual void Complete(dispatch_task_t *task) = 0;
+};
+
+// completion for tasks that are owned by the dispatch queue itself and must
+// not be deleted by the worker
+class PersistentTask : public TaskCompletion {
+ public:
+  void Complete(dispatch_task_t *task) override {}
+};
+
+static PersistentTask persistent_task;
+
+// Blocks while the word has the value seen, or until the timeout has passed
+// if there is one, may return spuriously
+static void futex_wait(uint32_t *word, uint32_t seen,
+                       const struct timespec *timeout = nullptr) {
+#if defined(__linux__)
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, timeout, nullptr, 0);
+#else
+  // NOTE: without futexes the waiter polls
+  std::this_thread::yield();
+#endif
+}
+
+// Wakes up to count of the threads blocked on the word
+static void futex_wake(uint32_t *word, int count = INT_MAX) {
+#if defined(__linux__)
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#endif
+}
+
+// A thread waiting on a set of event counters.  Every counter in the set
+// notifies the same futex word, which counts the counters that completed.
+class CompletionWaiter {
+ public:
+  CompletionWaiter() : word(0) {}
+
+  void Notify() {
+    __atomic_add_fetch(&word, 1, __ATOMIC_RELEASE);
+    futex_wake(&word);
+  }
+
+  // Waits until the word is not seen, returns the new value
+  uint32_t Wait(uint32_t seen) {
+    uint32_t value;
+    while ((value = __atomic_load_n(&word, __ATOMIC_ACQUIRE)) == seen) {
+      futex_wait(&word, seen);
+    }
+    return value;
+  }
+
+ private:
+  uint32_t word;
+};
+
+class EventCounter : public TaskCompletion {
  public:
-  EventCounter(size_t count) : count(count) {}
+  EventCounter(size_t count, const dispatch_allocator_t *allocator)
+      : count(count), allocator(allocator) {}
+
+  // Creates a counter with memory from the allocator, or from the global
+  // allocator if it is NULL
+  template <typename T = EventCounter>
+  static T *Create(size_t count, const dispatch_allocator_t *allocator) {
+    allocator = allocator_resolve(allocator);
+    return allocator_new<T>(allocator, count, allocator);
+  }
+
+  // Destroys a counter made by Create
+  static void Delete(EventCounter *counter) {
+    allocator_delete(counter->allocator, counter);
+  }
+
+  void Complete(dispatch_task_t *task) override { Signal(); }
 
   void Wait() const {
     std::unique_lock<std::mutex> lock(mutex);
     condition.wait(lock, [&]() -> bool { return (count == 0); });
   }
 
+  bool WaitUntil(std::chrono::steady_clock::time_point deadline) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return condition.wait_until(lock, deadline,
+                                [&]() -> bool { return (count == 0); });
+  }
+
+  // Rearms the counter, must not be called while it is being waited on
+  void Reset(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->count = count;
+  }
+
   void Signal() {
-    mutex.lock();
+    // NOTE: notify while holding the lock, the waiter may delete this counter
+    //       as soon as it observes a zero count
+    std::unique_lock<std::mutex> lock(mutex);
     if (count > 0) --count;
-    mutex.unlock();
-    if (count == 0) condition.notify_all();
+    if (count == 0) {
+      condition.notify_all();
+      if (waiter) waiter->Notify();
+    }
+  }
+
+  // Registers the waiter to be notified on completion, returns true if the
+  // counter has already completed and will not notify
+  bool Register(CompletionWaiter *waiter) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->waiter = waiter;
+    return (count == 0);
+  }
+
+  // Unregisters the waiter, returns true if the counter has completed
+  bool Unregister() {
+    std::unique_lock<std::mutex> lock(mutex);
+    waiter = nullptr;
+    return (count == 0);
   }
 
  protected:
   size_t count;
+  CompletionWaiter *waiter = nullptr;
+  const dispatch_allocator_t *allocator;  // frees the counter
   mutable std::mutex mutex;
   mutable std::condition_variable condition;
 };
 
-class BinarySemaphore : public EventCounter {
- public:
-  BinarySemaphore() : EventCounter(1) {}
-
-  void Reset() {
-    mutex.lock();
-    count = 1;
-    mutex.unlock();
-  }
+// the event counter interface used by the queue independent sources
+struct event_counter_struct : public EventCounter {
+  event_counter_struct(size_t count, const dispatch_allocator_t *allocator)
+      : EventCounter(count, allocator) {}
 };
 
 //***********************
@@ -60,240 +228,2030 @@ class BinarySemaphore : public EventCounter {
 //***********************
 //***********************
 //***********************
+// size (in bytes) of a cache line, state that different threads write is
+// kept on separate lines so the writes do not invalidate each other
+#ifndef DISPATCH_CACHE_LINE_SIZE
+#define DISPATCH_CACHE_LINE_SIZE (64)
+#endif
+
+#ifndef DISPATCH_BLOCKING_POOL_SIZE
+#define DISPATCH_BLOCKING_POOL_SIZE (64)
+#endif
+
+#ifndef DISPATCH_BLOCKING_POOL_IDLE_TIMEOUT_MS
+#define DISPATCH_BLOCKING_POOL_IDLE_TIMEOUT_MS (1000)
+#endif
+
+typedef struct dispatch_host_pool_struct dispatch_host_pool_t;
+typedef struct dispatch_host_ring_struct dispatch_host_ring_t;
+typedef struct dispatch_host_shard_struct dispatch_host_shard_t;
 typedef struct dispatch_host_struct dispatch_host_queue_t;
-struct dispatch_host_struct {
+typedef struct dispatch_host_task_table_struct dispatch_host_task_table_t;
+typedef struct dispatch_host_worker_struct dispatch_host_worker_t;
+
+// with a task table, the deque holds 32-bit handles, a task in the table is
+// the index of the task in the table, other tasks are kept in the pointer
+// list and their handles only carry the flag.  Without a table, the pointer
+// list is the deque.
+typedef uint32_t task_handle_t;
+#define TASK_HANDLE_EXTERNAL ((task_handle_t)1 << 31)
+
+// ends the task table's free list
+#define TASK_TABLE_END (UINT32_MAX)
+
+struct dispatch_host_task_table_struct {
+  dispatch_task_t *tasks;  // contiguous array of tasks, indexed by handle
+  uint32_t *next;          // the next free task after each free task
+  size_t length;           // number of tasks in the table
+  dispatch_allocator_t allocator;  // frees deleted tasks back to the table
+  // first free task in the low word, the high word counts the updates so a
+  // stale compare-exchange fails.  Written by every thread that creates or
+  // deletes a task.
+  alignas(DISPATCH_CACHE_LINE_SIZE) uint64_t free;
+};
+
+// one of the submission deques of a sharded queue, producers lock only the
+// shard they add to.  Shards hold task pointers rather than handles.
+// NOTE: producers on different shards write their locks at the same time, so
+//       shards do not share a cache line
+struct alignas(DISPATCH_CACHE_LINE_SIZE) dispatch_host_shard_struct {
   std::mutex lock;
-  std::condition_variable cv;
-  std::vector<std::thread> threads;
   std::deque<dispatch_task_t *> deque;
-  std::vector<BinarySemaphore *> thread_ready_semaphores;
+  size_t length;  // tasks in the deque, read without the lock
+  // cache domain of the last pinned worker to make this its home shard, -1
+  // if none has.  Written while holding the queue lock, read without it.
+  int cache_domain;
+};
+
+// a ring of tasks that the queue's single producer adds to without locking,
+// workers take tasks by advancing the head with a compare-exchange
+struct dispatch_host_ring_struct {
+  dispatch_task_t **tasks;
+  size_t mask;  // one less than the capacity, a power of two
+  // next task to take, written by the workers
+  alignas(DISPATCH_CACHE_LINE_SIZE) size_t head;
+  // next free slot, written by the producer along with the head it last
+  // read and the identity of its thread
+  alignas(DISPATCH_CACHE_LINE_SIZE) size_t tail;
+  size_t head_seen;
+  uint64_t producer;  // thread id, zero until the first task is added
+};
+
+// NOTE: each worker writes its scratch arena after every task, so workers
+//       do not share a cache line
+struct alignas(DISPATCH_CACHE_LINE_SIZE) dispatch_host_worker_struct {
+  pthread_t thread;
+  dispatch_host_queue_t *queue;
+  int slot;  // index of the CPU the worker is pinned to, -1 if not pinned
+  int cache_domain;  // of the CPU the worker is pinned to, -1 if not pinned
+  size_t shard;      // index of the shard polled first
+  bool exited;       // left the run loop, written while holding the lock
+  std::deque<dispatch_task_t *> broadcasts;  // performed before the deque
+  scratch_arena_t scratch;                   // reset after each task
+  // tasks taken from the deque, only touched by the worker's own thread
+  dispatch_task_t *batch[DISPATCH_WORKER_BATCH_SIZE];
+  size_t batch_next;   // index of the next task to perform
+  size_t batch_count;  // number of tasks in the batch
+  // the task most recently added by the worker's own tasks, performed next.
+  // Written by the worker's own thread, an idle worker may steal the task
+  // with a compare-exchange once it has waited too long.
+  dispatch_task_t *next;
+  // the task an idle worker last saw in next and when, written while holding
+  // the queue lock
+  dispatch_task_t *next_seen;
+  std::chrono::steady_clock::time_point next_seen_time;
+  size_t local_runs;  // local tasks performed since the deque was last taken
+  // tasks displaced from next, newest last, touched while holding the queue
+  // lock.  Idle workers steal the oldest.
+  dispatch_task_t *local[DISPATCH_WORKER_LOCAL_SIZE];
+  size_t local_count;
+};
+
+struct dispatch_host_struct {
+  // written by producers and workers while holding the lock
+  alignas(DISPATCH_CACHE_LINE_SIZE) std::mutex lock;
+  std::deque<task_handle_t> deque;
+  std::deque<dispatch_task_t *> pointers;  // tasks not in the task table
+  size_t live_count;     // number of started workers that have not exited
+  size_t idle_count;     // number of started workers waiting for work
+  size_t busy_count;     // number of workers performing a task
+  size_t blocked_count;  // number of workers compensated for blocking
+  size_t broadcast_count;  // broadcasts waiting in the workers' mailboxes
+  size_t local_count;      // tasks waiting on the workers' local stacks
   bool quit;
+  bool scheduled;  // drain_task is in the target's deque
+  // idle worker that times the tasks in the next slots, NULL if none
+  dispatch_host_worker_t *watcher;
+  std::vector<dispatch_host_worker_t *> workers;
+  std::vector<dispatch_host_worker_t *> retired;  // exited, to be joined
+  // tasks waiting in the shards, written by producers and workers while
+  // holding a shard's lock.  The idle and live counts are written
+  // atomically, producers adding to a shard read them without the lock.
+  alignas(DISPATCH_CACHE_LINE_SIZE) size_t sharded_count;
+  // notified after the lock is released.  Idle workers wait on the wake
+  // word, which is incremented without the lock when work has arrived, and
+  // idle_cv signals waiters that the queue is idle.
+  alignas(DISPATCH_CACHE_LINE_SIZE) uint32_t wake;
+  std::condition_variable idle_cv;
+  // read-mostly, set when the queue is created or a worker starts.
+  // thread_count is the maximum number of workers.
+  alignas(DISPATCH_CACHE_LINE_SIZE) size_t thread_count;
+  std::chrono::milliseconds idle_timeout;  // zero if workers never retire
+  // no idle worker is timing the tasks in the next slots, local_add wakes
+  // one.  Written while holding the lock, read by local_add without it.
+  bool unwatched;
+  // workers are restricted to these CPUs, empty if they may run on any CPU
+  std::vector<int> cpus;            // in placement order if pinned
+  std::vector<size_t> cpu_workers;  // number of workers pinned to each CPU
+  bool pinned;                      // each worker is pinned to one CPU
+  // deques that producers add to instead of the queue's, empty if the queue
+  // is not sharded
+  std::vector<dispatch_host_shard_t *> shards;
+  dispatch_host_ring_t *ring;  // NULL unless the queue has a single producer
+  // workers are created with these pthread attributes
+  size_t stack_size;        // in bytes, zero for the default stack
+  size_t stack_guard_size;  // in bytes
+  int sched_policy;
+  int sched_priority;
+  int nice;
+  // each worker calls the hooks in its own thread
+  dispatch_worker_start_t start_hook;  // NULL if there is no start hook
+  dispatch_worker_stop_t stop_hook;    // NULL if there is no stop hook
+  void *hook_argument;
+  size_t scratch_size;            // size of each worker's scratch arena
+  size_t scratch_high_watermark;  // of the workers that have been joined
+  // logical queues submit their tasks to the target's workers
+  dispatch_host_pool_t *pool;     // NULL if the queue owns its workers
+  dispatch_host_queue_t *target;  // NULL if the queue owns its workers
+  dispatch_task_t drain_task;     // scheduled on the target to run a task
+  // blocking tasks are sent to a logical queue on the blocking pool
+  dispatch_host_queue_t *blocking_queue;  // created by the first blocking task
+  bool caller_storage;  // placed in storage provided by the caller
+  const dispatch_allocator_t *allocator;  // allocates the queue's memory
+  dispatch_host_task_table_t table;       // tasks created for this queue, its
+                                          // free list is on its own line
+};
+
+// process-wide worker pool that is shared by logical queues
+struct dispatch_host_pool_struct {
+  dispatch_host_pool_struct(size_t thread_count, size_t idle_timeout_ms)
+      : queue(nullptr),
+        refs(0),
+        thread_count(thread_count),
+        idle_timeout_ms(idle_timeout_ms) {}
+
+  std::mutex lock;
+  dispatch_host_queue_t *queue;  // created with the first logical queue
+  size_t refs;                   // number of logical queues
+  size_t thread_count;           // zero to match the hardware concurrency
+  size_t idle_timeout_ms;        // zero if workers never retire
 };
 
+static dispatch_host_pool_t shared_pool(0, 0);
+static dispatch_host_pool_t blocking_pool(
+    DISPATCH_BLOCKING_POOL_SIZE, DISPATCH_BLOCKING_POOL_IDLE_TIMEOUT_MS);
+
+// the queue that the current thread is a worker of
+static thread_local dispatch_host_queue_t *worker_queue = nullptr;
+// the context returned by the current worker's start hook
+static thread_local void *worker_context = nullptr;
+// the current worker's scratch arena
+static thread_local scratch_arena_t *worker_scratch = nullptr;
+// the current worker
+static thread_local dispatch_host_worker_t *worker_self = nullptr;
+// the task the current thread is performing
+static thread_local dispatch_task_t *worker_task = nullptr;
+
+static void task_run(dispatch_task_t *task) {
+  // NOTE: the completion is read before performing the task because tasks
+  //       owned by a logical queue or a graph may not outlive their function
+  TaskCompletion *completion = static_cast<TaskCompletion *>(task->private_data);
+  bool waitable = task->waitable;
+  bool persistent = task->persistent;
+  dispatch_group_t *group = task->group;
+
+  // cancelled tasks are skipped but still complete
+  if (!dispatch_task_is_cancelled(task)) {
+    // NOTE: a logical queue's drain task performs its tasks inside itself
+    dispatch_task_t *previous = worker_task;
+    worker_task = task;
+    dispatch_task_perform(task);
+    worker_task = previous;
+  }
+
+  if (completion) {
+    // signal the task's completion
+    completion->Complete(task);
+  } else if (waitable || persistent) {
+    // the task is deleted by its group's wait, its graph or its reusable group
+  } else if (task->completion) {
+    // hand the task to the completion queue's consumer
+    completion_ring_push(task->completion, task);
+  } else {
+    // the contract is that the worker must delete non-waitable tasks
+    dispatch_task_delete(task);
+  }
+  // NOTE: the group may be deleted as soon as the task leaves it
+  if (group) dispatch_group_leave(group);
+}
+
 //***********************
 //***********************
 //***********************
-// Worker
+// Task table
 //***********************
 //***********************
 //***********************
-void dispatch_queue_worker(dispatch_host_queue_t *dispatch_queue,
-                           BinarySemaphore *ready_semaphore) {
-  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+// Takes a free task from the table, returns NULL if the table is full
+DISPATCH_ALLOCATOR_FUNCTION
+static void *task_table_malloc(void *context, size_t size) {
+  dispatch_host_task_table_t *table =
+      static_cast<dispatch_host_task_table_t *>(context);
+  dispatch_assert(size == sizeof(dispatch_task_t));
 
-  dispatch_printf("dispatch_queue_worker started: parent=%u\n",
-                  (size_t)dispatch_queue);
+  uint64_t head = __atomic_load_n(&table->free, __ATOMIC_ACQUIRE);
+  uint64_t next;
+  uint32_t index;
+  do {
+    index = static_cast<uint32_t>(head);
+    if (index == TASK_TABLE_END) return nullptr;
+    // NOTE: the next index may be stale if another thread took the task,
+    //       the update count makes the exchange fail in that case
+    uint32_t following = __atomic_load_n(&table->next[index], __ATOMIC_RELAXED);
+    next = (((head >> 32) + 1) << 32) | following;
+  } while (!__atomic_compare_exchange_n(&table->free, &head, next, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  return &table->tasks[index];
+}
+
+// Returns a deleted task to the table
+DISPATCH_ALLOCATOR_FUNCTION
+static void task_table_free(void *context, void *ptr) {
+  dispatch_host_task_table_t *table =
+      static_cast<dispatch_host_task_table_t *>(context);
+  uint32_t index = static_cast<dispatch_task_t *>(ptr) - table->tasks;
+  dispatch_assert(index < table->length);
 
+  uint64_t head = __atomic_load_n(&table->free, __ATOMIC_RELAXED);
+  uint64_t next;
   do {
-    // give the ready signal
-    ready_semaphore->Signal();
+    __atomic_store_n(&table->next[index], static_cast<uint32_t>(head),
+                     __ATOMIC_RELAXED);
+    next = (((head >> 32) + 1) << 32) | index;
+  } while (!__atomic_compare_exchange_n(&table->free, &head, next, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-    // wait until we have data or a quit signal
-    dispatch_queue->cv.wait(lock, [dispatch_queue] {
-      return (dispatch_queue->deque.size() || dispatch_queue->quit);
-    });
+// Allocates the table's tasks from the allocator, a table of length zero
+// has no tasks
+static void task_table_init(dispatch_host_task_table_t *table, size_t length,
+                            const dispatch_allocator_t *allocator) {
+  // NOTE: the top bit of a handle is the external flag
+  dispatch_assert(length < TASK_HANDLE_EXTERNAL);
 
-    // after wait, we own the lock
-    if (!dispatch_queue->quit && dispatch_queue->deque.size()) {
-      // clear the ready signal
-      ready_semaphore->Reset();
+  table->length = length;
+  table->tasks = nullptr;
+  table->next = nullptr;
+  table->free = TASK_TABLE_END;
+  table->allocator.malloc = task_table_malloc;
+  table->allocator.free = task_table_free;
+  table->allocator.context = table;
+  if (length == 0) return;
 
-      // pop the task off the deque
-      dispatch_task_t *task = dispatch_queue->deque.front();
-      dispatch_queue->deque.pop_front();
+  table->tasks = static_cast<dispatch_task_t *>(
+      allocator_malloc(allocator, sizeof(dispatch_task_t) * length));
+  table->next = static_cast<uint32_t *>(
+      allocator_malloc(allocator, sizeof(uint32_t) * length));
+  // chain the free list in index order so the first tasks are used first
+  for (size_t i = 0; i < length; i++) {
+    table->next[i] = (i + 1 < length) ? i + 1 : TASK_TABLE_END;
+  }
+  table->free = 0;
+}
 
-      // unlock now that we're done messing with the queue
-      lock.unlock();
+static void task_table_deinit(dispatch_host_task_table_t *table,
+                              const dispatch_allocator_t *allocator) {
+  if (table->length == 0) return;
 
-      // perform the task
-      dispatch_task_perform(task);
+  allocator_free(allocator, table->tasks);
+  allocator_free(allocator, table->next);
+}
 
-      if (task->waitable) {
-        // clear semaphore to signal the task is complete
-        EventCounter *counter = static_cast<EventCounter *>(task->private_data);
-        counter->Signal();
-      } else {
-        // the contract is that the worker must delete non-waitable tasks
-        dispatch_task_delete(task);
-      }
+// Returns the number of tasks in the deque
+// NOTE: the caller must hold the queue lock
+static size_t deque_size(dispatch_host_queue_t *dispatch_queue) {
+  if (dispatch_queue->table.length == 0) return dispatch_queue->pointers.size();
+  return dispatch_queue->deque.size();
+}
 
-      lock.lock();
-    }
-  } while (!dispatch_queue->quit);
+// Adds the task to the back of the deque
+// NOTE: the caller must hold the queue lock
+static void deque_push(dispatch_host_queue_t *dispatch_queue,
+                       dispatch_task_t *task) {
+  dispatch_host_task_table_t *table = &dispatch_queue->table;
+
+  if (table->length == 0) {
+    dispatch_queue->pointers.push_back(task);
+  } else if (task->allocator == &table->allocator) {
+    dispatch_queue->deque.push_back(task - table->tasks);
+  } else {
+    dispatch_queue->pointers.push_back(task);
+    dispatch_queue->deque.push_back(TASK_HANDLE_EXTERNAL);
+  }
+}
+
+// Returns a task that was taken from the deque to its front
+// NOTE: the caller must hold the queue lock
+static void deque_push_front(dispatch_host_queue_t *dispatch_queue,
+                             dispatch_task_t *task) {
+  dispatch_host_task_table_t *table = &dispatch_queue->table;
+
+  if (table->length == 0) {
+    dispatch_queue->pointers.push_front(task);
+  } else if (task->allocator == &table->allocator) {
+    dispatch_queue->deque.push_front(task - table->tasks);
+  } else {
+    dispatch_queue->pointers.push_front(task);
+    dispatch_queue->deque.push_front(TASK_HANDLE_EXTERNAL);
+  }
+}
+
+// Removes the task at the front of the deque
+// NOTE: the caller must hold the queue lock
+static dispatch_task_t *deque_pop(dispatch_host_queue_t *dispatch_queue) {
+  task_handle_t handle = TASK_HANDLE_EXTERNAL;
+
+  if (dispatch_queue->table.length) {
+    handle = dispatch_queue->deque.front();
+    dispatch_queue->deque.pop_front();
+  }
+  if (handle & TASK_HANDLE_EXTERNAL) {
+    // external tasks are kept in the same order as their handles
+    dispatch_task_t *task = dispatch_queue->pointers.front();
+    dispatch_queue->pointers.pop_front();
+    return task;
+  }
+  return &dispatch_queue->table.tasks[handle];
 }
 
 //***********************
 //***********************
 //***********************
-// Queue implementation
+// Worker
 //***********************
 //***********************
 //***********************
-static void task_add(dispatch_host_queue_t *dispatch_queue,
-                     dispatch_task_t *task, EventCounter *counter) {
-  if (counter) {
-    task->private_data = counter;
-  }
-
-  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
-  dispatch_queue->deque.push_back(task);
-  // manual unlocking is done before notifying, to avoid waking up
-  // the waiting thread only to block again (see notify_one for details)
-  lock.unlock();
-
-  dispatch_queue->cv.notify_one();
+// NOTE: the caller must hold the queue lock
+static size_t worker_limit(dispatch_host_queue_t *dispatch_queue) {
+  // workers that are blocked are compensated for with extra workers
+  return dispatch_queue->thread_count + dispatch_queue->blocked_count;
 }
 
-dispatch_queue_t *dispatch_queue_create(size_t length, size_t thread_count,
-                                        size_t thread_stack_size,
-                                        size_t thread_priority) {
-  dispatch_host_queue_t *dispatch_queue;
+// Restricts the calling worker to the queue's CPUs, or to the CPU in slot if
+// the workers are pinned
+static void worker_set_affinity(dispatch_host_queue_t *dispatch_queue,
+                                int slot) {
+#if defined(__linux__)
+  cpu_set_t cpu_set;
 
-  dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
-                  thread_count);
+  CPU_ZERO(&cpu_set);
+  if (slot >= 0) {
+    CPU_SET(dispatch_queue->cpus[slot], &cpu_set);
+  } else {
+    for (int cpu : dispatch_queue->cpus) CPU_SET(cpu, &cpu_set);
+  }
+  // NOTE: failure is not fatal, the worker runs wherever it is scheduled
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+    dispatch_printf("worker_set_affinity failed: parent=%u\n",
+                    (size_t)dispatch_queue);
+  }
+#endif
+}
 
-  dispatch_queue = new dispatch_host_queue_t;
-  dispatch_queue->threads.resize(thread_count);
-  dispatch_queue->thread_ready_semaphores.resize(thread_count);
+// Adds the queue's nice increment to the calling worker's inherited nice level
+static void worker_set_nice(dispatch_host_queue_t *dispatch_queue) {
+#if defined(__linux__)
+  // NOTE: Linux applies the nice level to the thread rather than the process
+  pid_t tid = syscall(SYS_gettid);
+  // NOTE: -1 is a valid nice level, errno tells it apart from a failure
+  errno = 0;
+  int inherited = getpriority(PRIO_PROCESS, tid);
+  if (errno ||
+      setpriority(PRIO_PROCESS, tid, inherited + dispatch_queue->nice) != 0) {
+    // lowering the nice level requires CAP_SYS_NICE or RLIMIT_NICE
+    dispatch_printf("worker_set_nice failed: parent=%u\n",
+                    (size_t)dispatch_queue);
+  }
+#endif
+}
 
-  // initialize the queue
-  dispatch_queue_init(dispatch_queue, thread_priority);
+// Returns the number of tasks a worker takes from the deque at once, its
+// share of the waiting tasks so the queue's other workers, including those
+// not started yet, are not left idle.  Shallow deques are taken one task at
+// a time.
+// NOTE: the caller must hold the queue lock
+static size_t worker_batch_size(dispatch_host_queue_t *dispatch_queue) {
+  size_t share = deque_size(dispatch_queue) / worker_limit(dispatch_queue);
 
-  dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
+  return std::min<size_t>(std::max<size_t>(share, 1),
+                          DISPATCH_WORKER_BATCH_SIZE);
+}
 
-  return dispatch_queue;
+// Takes the task in the worker's next slot, NULL if the slot is empty or an
+// idle worker stole the task
+// NOTE: must be called from the worker's own thread
+static dispatch_task_t *next_take(dispatch_host_worker_t *worker) {
+  if (__atomic_load_n(&worker->next, __ATOMIC_RELAXED) == nullptr)
+    return nullptr;
+  return __atomic_exchange_n(&worker->next, nullptr, __ATOMIC_ACQUIRE);
 }
 
-void dispatch_queue_init(dispatch_queue_t *ctx, size_t thread_priority) {
-  dispatch_host_queue_t *dispatch_queue =
-      static_cast<dispatch_host_queue_t *>(ctx);
-  dispatch_assert(dispatch_queue);
+// Returns true if a task waits in any worker's next slot
+// NOTE: the caller must hold the queue lock
+static bool next_waiting(dispatch_host_queue_t *dispatch_queue) {
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    if (__atomic_load_n(&worker->next, __ATOMIC_SEQ_CST)) return true;
+  }
+  return false;
+}
 
-  dispatch_printf("dispatch_queue_init: %u\n", (size_t)dispatch_queue);
+// Returns a worker whose next slot has held the same task for the steal
+// delay, the task is stranded behind a long task.  The tasks seen in the
+// slots for the first time are timed from now.
+// NOTE: the caller must hold the queue lock
+static dispatch_host_worker_t *next_stranded(
+    dispatch_host_queue_t *dispatch_queue) {
+  std::chrono::steady_clock::time_point now;
+  bool timed = false;
 
-  dispatch_queue->quit = false;
-  for (size_t i = 0; i < dispatch_queue->threads.size(); i++) {
-    dispatch_queue->thread_ready_semaphores[i] = new BinarySemaphore();
-    dispatch_queue->threads[i] =
-        std::thread(&dispatch_queue_worker, dispatch_queue,
-                    dispatch_queue->thread_ready_semaphores[i]);
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    dispatch_task_t *task = __atomic_load_n(&worker->next, __ATOMIC_RELAXED);
+    if (task == nullptr) continue;
+    if (!timed) {
+      now = std::chrono::steady_clock::now();
+      timed = true;
+    }
+    if (task != worker->next_seen) {
+      worker->next_seen = task;
+      worker->next_seen_time = now;
+    } else if (now - worker->next_seen_time >=
+               std::chrono::microseconds(DISPATCH_WORKER_NEXT_STEAL_US)) {
+      return worker;
+    }
   }
+  return nullptr;
 }
 
-void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
-  dispatch_host_queue_t *dispatch_queue =
-      static_cast<dispatch_host_queue_t *>(ctx);
-  dispatch_assert(dispatch_queue);
-  dispatch_assert(task);
-
-  dispatch_printf("dispatch_queue_add_task: %u\n", (size_t)dispatch_queue);
+// Steals a task stranded in another worker's next slot, returns NULL if there
+// is none
+// NOTE: the caller must hold the queue lock
+static dispatch_task_t *next_steal(dispatch_host_queue_t *dispatch_queue) {
+  dispatch_host_worker_t *victim = next_stranded(dispatch_queue);
 
-  EventCounter *counter = nullptr;
+  if (victim == nullptr) return nullptr;
 
-  if (task->waitable) {
-    counter = new EventCounter(1);
-  }
-  task_add(dispatch_queue, task, counter);
+  // NOTE: fails if the owner has taken the task since it was seen
+  dispatch_task_t *task = victim->next_seen;
+  victim->next_seen = nullptr;
+  if (!__atomic_compare_exchange_n(&victim->next, &task, nullptr, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return nullptr;
+  return task;
 }
 
-void dispatch_queue_group_add(dispatch_queue_t *ctx, dispatch_group_t *group) {
-  dispatch_host_queue_t *dispatch_queue =
-      static_cast<dispatch_host_queue_t *>(ctx);
-  dispatch_assert(dispatch_queue);
-  dispatch_assert(group);
+// Takes the oldest task off the worker's local stack
+// NOTE: the caller must hold the queue lock
+static dispatch_task_t *local_take_oldest(dispatch_host_worker_t *worker) {
+  dispatch_task_t *task = worker->local[0];
 
-  dispatch_printf("dispatch_queue_group_add: %u   group=%u\n",
-                  (size_t)dispatch_queue, (size_t)group);
+  std::copy(worker->local + 1, worker->local + worker->local_count,
+            worker->local);
+  worker->local_count--;
+  worker->queue->local_count--;
+  return task;
+}
 
-  EventCounter *counter = nullptr;
+// Takes the oldest local task of the first worker that has one, workers
+// sharing the thief's last level cache are robbed first
+// NOTE: the caller must hold the queue lock
+static dispatch_task_t *local_steal(dispatch_host_worker_t *thief) {
+  dispatch_host_queue_t *dispatch_queue = thief->queue;
+  dispatch_host_worker_t *victim = nullptr;
 
-  if (group->waitable) {
-    // create event counter
-    counter = new EventCounter(group->count);
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    if (worker->local_count == 0) continue;
+    if (worker->cache_domain == thief->cache_domain)
+      return local_take_oldest(worker);
+    if (victim == nullptr) victim = worker;
   }
+  return victim ? local_take_oldest(victim) : nullptr;
+}
 
-  for (int i = 0; i < group->count; i++) {
-    task_add(dispatch_queue, group->tasks[i], counter);
+// Returns the worker's local tasks to the front of the deque, in the order
+// the worker would have performed them, returns true if there were any
+// NOTE: the caller must hold the queue lock and be the worker's own thread
+static bool local_return(dispatch_host_worker_t *worker) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  dispatch_task_t *next = next_take(worker);
+  bool returned = (next || worker->local_count);
+
+  for (size_t i = 0; i < worker->local_count; i++) {
+    deque_push_front(dispatch_queue, worker->local[i]);
   }
+  dispatch_queue->local_count -= worker->local_count;
+  worker->local_count = 0;
+  if (next) deque_push_front(dispatch_queue, next);
+  return returned;
 }
 
-void dispatch_queue_task_wait(dispatch_queue_t *ctx, dispatch_task_t *task) {
-  dispatch_assert(task);
-  dispatch_assert(task->waitable);
+// Returns the number of tasks waiting in the queue's ring
+static size_t ring_tasks(dispatch_host_ring_t *ring) {
+  // NOTE: the head is read first, the tail can only have moved past it
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) - head;
+}
 
-  dispatch_printf("dispatch_queue_task_wait: %u   task=%u\n", (size_t)ctx,
-                  (size_t)task);
+// Returns the number of tasks that were added without the queue lock and
+// are waiting in the queue's shards or ring
+static size_t unlocked_tasks(dispatch_host_queue_t *dispatch_queue) {
+  size_t count = __atomic_load_n(&dispatch_queue->sharded_count,
+                                 __ATOMIC_SEQ_CST);
+  if (dispatch_queue->ring) count += ring_tasks(dispatch_queue->ring);
+  return count;
+}
 
-  if (task->waitable) {
-    EventCounter *counter = static_cast<EventCounter *>(task->private_data);
-    // wait on the task's semaphore which signals that it is complete
-    counter->Wait();
-    // the contract is that the dispatch queue must delete waitable tasks
-    delete counter;
-    dispatch_task_delete(task);
+// Takes a batch of tasks from the ring, returns the number of tasks taken
+static size_t ring_pop(dispatch_host_worker_t *worker) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  dispatch_host_ring_t *ring = dispatch_queue->ring;
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  for (;;) {
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) return 0;
+
+    // the worker's share of the ring, as for the queue's deque
+    size_t share =
+        (tail - head) / std::max<size_t>(dispatch_queue->thread_count, 1);
+    size_t batch_count = std::min<size_t>(std::max<size_t>(share, 1),
+                                          DISPATCH_WORKER_BATCH_SIZE);
+    // NOTE: the producer does not reuse a slot until the head has passed it,
+    //       so the tasks read are valid if the head has not moved
+    for (size_t i = 0; i < batch_count; i++) {
+      worker->batch[i] = __atomic_load_n(
+          &ring->tasks[(head + i) & ring->mask], __ATOMIC_RELAXED);
+    }
+    if (__atomic_compare_exchange_n(&ring->head, &head, head + batch_count,
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return batch_count;
   }
 }
 
-void dispatch_queue_group_wait(dispatch_queue_t *ctx, dispatch_group_t *group) {
-  dispatch_assert(group);
-  dispatch_assert(group->waitable);
+// Takes a batch of tasks from the worker's home shard, or from the next
+// shard that has tasks, returns the number of tasks taken.  The shards of
+// workers sharing this worker's last level cache are tried before the rest.
+static size_t shard_pop(dispatch_host_worker_t *worker) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  size_t count = dispatch_queue->shards.size();
 
-  dispatch_printf("dispatch_queue_group_wait: %u   group=%u\n", (size_t)ctx,
-                  (size_t)group);
+  for (size_t i = 0; i < 2 * count; i++) {
+    dispatch_host_shard_t *shard =
+        dispatch_queue->shards[(worker->shard + i) % count];
+    // the first pass visits the home shard and the near shards, the second
+    // pass the far ones
+    bool near = (i == 0) || (__atomic_load_n(&shard->cache_domain,
+                                             __ATOMIC_RELAXED) ==
+                             worker->cache_domain);
+    if (near != (i < count)) continue;
+    if (__atomic_load_n(&shard->length, __ATOMIC_RELAXED) == 0) continue;
 
-  if (group->waitable) {
-    EventCounter *counter =
-        static_cast<EventCounter *>(group->tasks[0]->private_data);
-    counter->Wait();
-    delete counter;
+    std::unique_lock<std::mutex> lock(shard->lock);
+    if (shard->deque.empty()) continue;
+    // the worker's share of the shard, as for the queue's deque
+    size_t share = shard->deque.size() * count /
+                   std::max<size_t>(dispatch_queue->thread_count, 1);
+    size_t batch_count = std::min<size_t>(
+        std::min<size_t>(std::max<size_t>(share, 1),
+                         DISPATCH_WORKER_BATCH_SIZE),
+        shard->deque.size());
+    for (size_t j = 0; j < batch_count; j++) {
+      worker->batch[j] = shard->deque.front();
+      shard->deque.pop_front();
+    }
+    __atomic_store_n(&shard->length, shard->deque.size(), __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&dispatch_queue->sharded_count, batch_count,
+                       __ATOMIC_SEQ_CST);
+    return batch_count;
   }
+  return 0;
 }
 
-void dispatch_queue_wait(dispatch_queue_t *ctx) {
-  dispatch_host_queue_t *dispatch_queue =
-      static_cast<dispatch_host_queue_t *>(ctx);
-  dispatch_assert(dispatch_queue);
-
-  dispatch_printf("dispatch_queue_wait: %u\n", (size_t)dispatch_queue);
+// Wakes up to count idle workers without taking the queue lock
+// NOTE: must be called after the work is added, see worker_wait
+static void worker_wake(dispatch_host_queue_t *dispatch_queue,
+                        int count = INT_MAX) {
+  if (__atomic_load_n(&dispatch_queue->idle_count, __ATOMIC_SEQ_CST) == 0)
+    return;
+  __atomic_add_fetch(&dispatch_queue->wake, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&dispatch_queue->wake, count);
+}
 
-  int waiting_count;
+// Waits for the predicate, releasing the lock while blocked, returns false
+// if the queue's idle timeout passed first.  One idle worker is the watcher,
+// while tasks wait in next slots it wakes after each steal delay so a
+// stranded task is found.
+// NOTE: the worker is counted idle and reads the wake word before checking
+//       the predicate, a thread that adds work afterwards sees the idle
+//       worker and increments the word, so the wake is not missed
+template <typename Predicate>
+static bool worker_wait(dispatch_host_worker_t *worker,
+                        std::unique_lock<std::mutex> &lock,
+                        Predicate predicate) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + dispatch_queue->idle_timeout;
+  struct timespec timeout;
+  bool ready = true;
+  bool polling = false;  // the watcher waits at most the steal delay
 
-  // wait for deque to empty
   for (;;) {
-    std::unique_lock<std::mutex> lock(dispatch_queue->lock);
-    waiting_count = dispatch_queue->deque.size();
+    uint32_t seen = __atomic_load_n(&dispatch_queue->wake, __ATOMIC_SEQ_CST);
+    if (predicate()) break;
+
+    int64_t ns = -1;  // no timeout
+    if (dispatch_queue->idle_timeout.count()) {
+      ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               deadline - std::chrono::steady_clock::now())
+               .count();
+      if (ns <= 0) {
+        ready = false;
+        break;
+      }
+    }
+    if (dispatch_queue->watcher == nullptr) dispatch_queue->watcher = worker;
+    if (dispatch_queue->watcher == worker) {
+      if (!polling) {
+        // NOTE: the flag is set before the slots are checked and local_add
+        //       fills a slot before reading the flag, so a task added now
+        //       is either seen here or wakes this worker
+        if (!dispatch_queue->unwatched)
+          __atomic_store_n(&dispatch_queue->unwatched, true,
+                           __ATOMIC_SEQ_CST);
+        polling = next_waiting(dispatch_queue);
+      }
+      if (polling) {
+        if (dispatch_queue->unwatched)
+          __atomic_store_n(&dispatch_queue->unwatched, false,
+                           __ATOMIC_SEQ_CST);
+        int64_t delay = DISPATCH_WORKER_NEXT_STEAL_US * 1000;
+        if (ns < 0 || ns > delay) ns = delay;
+      }
+    }
+
+    const struct timespec *remaining = nullptr;
+    if (ns >= 0) {
+      timeout.tv_sec = ns / 1000000000;
+      timeout.tv_nsec = ns % 1000000000;
+      remaining = &timeout;
+    }
     lock.unlock();
-    if (waiting_count == 0) break;
+    futex_wait(&dispatch_queue->wake, seen, remaining);
+    lock.lock();
+    // the watcher stops polling once a whole delay passes with the slots
+    // empty, a wake makes it poll at least once more
+    // NOTE: the workers are being deleted once the queue quits
+    if (dispatch_queue->quit) break;
+    polling = !polling || next_waiting(dispatch_queue);
   }
-  // wait for all workers to be ready
-  for (size_t i = 0; i < dispatch_queue->thread_ready_semaphores.size(); i++) {
-    dispatch_queue->thread_ready_semaphores[i]->Wait();
+
+  if (dispatch_queue->watcher == worker) {
+    // hand the watch over to another idle worker
+    dispatch_queue->watcher = nullptr;
+    __atomic_store_n(&dispatch_queue->unwatched, true, __ATOMIC_SEQ_CST);
+    if (!dispatch_queue->quit && dispatch_queue->idle_count > 1 &&
+        next_waiting(dispatch_queue))
+      worker_wake(dispatch_queue, 1);
   }
+  return ready;
 }
 
-void dispatch_queue_delete(dispatch_queue_t *ctx) {
-  dispatch_assert(ctx);
-  dispatch_host_queue_t *dispatch_queue =
-      static_cast<dispatch_host_queue_t *>(ctx);
+static void dispatch_queue_worker(dispatch_host_worker_t *worker) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  int slot = worker->slot;
 
-  dispatch_printf("dispatch_queue_delete: %u\n", (size_t)dispatch_queue);
+  if (dispatch_queue->cpus.size()) worker_set_affinity(dispatch_queue, slot);
+  if (dispatch_queue->nice) worker_set_nice(dispatch_queue);
+
+  // NOTE: the arena is allocated once the worker is pinned, so its pages
+  //       are first touched on the worker's CPU and placed on its node
+  scratch_arena_t *scratch = &worker->scratch;
+  scratch_arena_init(scratch, dispatch_queue->scratch_size,
+                     dispatch_queue->allocator);
+
+  // NOTE: the hooks are called without the lock so they may add tasks
+  dispatch_worker_stop_t stop_hook = dispatch_queue->stop_hook;
+  void *hook_argument = dispatch_queue->hook_argument;
+  if (dispatch_queue->start_hook)
+    worker_context = dispatch_queue->start_hook(hook_argument);
+
+  worker_scratch = scratch;
+  worker_self = worker;
 
-  // signal to all thread workers that it is time to quit
   std::unique_lock<std::mutex> lock(dispatch_queue->lock);
-  dispatch_queue->quit = true;
-  lock.unlock();
-  dispatch_queue->cv.notify_all();
 
-  // Wait for threads to finish before we exit
-  for (size_t i = 0; i < dispatch_queue->threads.size(); i++) {
-    if (dispatch_queue->threads[i].joinable()) {
-      dispatch_queue->threads[i].join();
+  dispatch_printf("dispatch_queue_worker started: parent=%u\n",
+                  (size_t)dispatch_queue);
+
+  worker_queue = dispatch_queue;
+
+  // exit if there are more workers than needed once blocking has ended
+  while (dispatch_queue->live_count <= worker_limit(dispatch_queue) ||
+         worker->broadcasts.size()) {
+    bool ready = true;
+    bool unlocked = false;
+    auto predicate = [dispatch_queue, worker] {
+      return (deque_size(dispatch_queue) || dispatch_queue->local_count ||
+              unlocked_tasks(dispatch_queue) || dispatch_queue->quit ||
+              worker->broadcasts.size() || next_stranded(dispatch_queue));
+    };
+
+    // wait until we have data or a quit signal
+    // NOTE: the worker counts itself idle before checking the shards, a
+    //       producer counts its task before checking for idle workers, so
+    //       one of them sees the other
+    __atomic_add_fetch(&dispatch_queue->idle_count, 1, __ATOMIC_SEQ_CST);
+    ready = worker_wait(worker, lock, predicate);
+    __atomic_sub_fetch(&dispatch_queue->idle_count, 1, __ATOMIC_SEQ_CST);
+
+    // after wait, we own the lock
+    worker->batch_next = 0;
+    if (worker->broadcasts.size()) {
+      // broadcasts are performed ahead of the deque, even when quitting
+      worker->batch[0] = worker->broadcasts.front();
+      worker->batch_count = 1;
+      worker->broadcasts.pop_front();
+      dispatch_queue->broadcast_count--;
+    } else {
+      // exit if quitting, or if idle for too long
+      if (dispatch_queue->quit || !ready) break;
+
+      worker->batch_count = 1;
+      if (worker->local_count &&
+          (worker->local_runs < DISPATCH_WORKER_LOCAL_RUNS ||
+           (deque_size(dispatch_queue) == 0 &&
+            unlocked_tasks(dispatch_queue) == 0))) {
+        // this worker's own local tasks are performed newest first
+        worker->batch[0] = worker->local[--worker->local_count];
+        dispatch_queue->local_count--;
+      } else if (deque_size(dispatch_queue)) {
+        // pop a batch of tasks off the deque
+        worker->batch_count = worker_batch_size(dispatch_queue);
+        for (size_t i = 0; i < worker->batch_count; i++) {
+          worker->batch[i] = deque_pop(dispatch_queue);
+        }
+        worker->local_runs = 0;
+      } else if (unlocked_tasks(dispatch_queue)) {
+        // the batch is taken from the ring or the shards once the lock is
+        // released
+        unlocked = true;
+        worker->batch_count = 0;
+        worker->local_runs = 0;
+      } else {
+        // steal a displaced local task, or one stranded in a next slot
+        dispatch_task_t *task = local_steal(worker);
+        if (task == nullptr) task = next_steal(dispatch_queue);
+        worker->batch[0] = task;
+        worker->batch_count = task ? 1 : 0;
+      }
+    }
+    dispatch_queue->busy_count++;
+
+    // unlock now that we're done messing with the queue
+    lock.unlock();
+
+    // NOTE: another worker may have emptied them, then the batch is empty
+    if (unlocked) {
+      worker->batch_count =
+          dispatch_queue->ring ? ring_pop(worker) : shard_pop(worker);
+    }
+
+    // perform the tasks, a task added by the previous task is performed
+    // before the rest of the batch unless the worker has performed too many
+    // in a row
+    // NOTE: dispatch_worker_blocking_begin may return the rest of the batch
+    //       to the deque
+    for (;;) {
+      dispatch_task_t *task = nullptr;
+      if (worker->local_runs < DISPATCH_WORKER_LOCAL_RUNS)
+        task = next_take(worker);
+      if (task) {
+        worker->local_runs++;
+      } else if (worker->batch_next < worker->batch_count) {
+        task = worker->batch[worker->batch_next++];
+      } else {
+        break;
+      }
+      task_run(task);
+      scratch_arena_reset(scratch);
+    }
+
+    lock.lock();
+    dispatch_task_t *next = next_take(worker);
+    if (next) {
+      // too many local tasks in a row, queue this one behind the deque
+      deque_push(dispatch_queue, next);
     }
+    dispatch_queue->busy_count--;
+    if (dispatch_queue->busy_count == 0 && deque_size(dispatch_queue) == 0 &&
+        dispatch_queue->local_count == 0 &&
+        unlocked_tasks(dispatch_queue) == 0 &&
+        dispatch_queue->broadcast_count == 0) {
+      // notify anyone waiting for the queue to drain
+      dispatch_queue->idle_cv.notify_all();
+    }
+  }
+
+  dispatch_printf("dispatch_queue_worker exiting: parent=%u\n",
+                  (size_t)dispatch_queue);
+
+  // another worker takes over the local tasks of a surplus worker
+  worker_self = nullptr;
+  bool returned = local_return(worker);
+  __atomic_sub_fetch(&dispatch_queue->live_count, 1, __ATOMIC_SEQ_CST);
+  if (slot >= 0) dispatch_queue->cpu_workers[slot]--;
+  worker->exited = true;
+  if (returned) worker_wake(dispatch_queue);
+  lock.unlock();
+
+  // the stop hook is not a worker, its blocking is not compensated
+  worker_queue = nullptr;
+  if (stop_hook) stop_hook(hook_argument, worker_context);
+  worker_context = nullptr;
+  worker_scratch = nullptr;
+  scratch_arena_free(scratch);
+
+  // NOTE: the worker may be joined and deleted once it is retired, so it is
+  //       not touched after this
+  lock.lock();
+  dispatch_queue->retired.push_back(worker);
+}
+
+static void *worker_main(void *arg) {
+  dispatch_queue_worker(static_cast<dispatch_host_worker_t *>(arg));
+  return nullptr;
+}
+
+//***********************
+//***********************
+//***********************
+// Queue implementation
+//***********************
+//***********************
+//***********************
+// Creates the worker's thread with the queue's stack and scheduling
+// attributes, returns false if the thread could not be created
+static bool worker_create(dispatch_host_worker_t *worker) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  pthread_attr_t attr;
+  int err;
+
+  pthread_attr_init(&attr);
+  if (dispatch_queue->stack_size) {
+    pthread_attr_setstacksize(&attr, dispatch_queue->stack_size);
+    pthread_attr_setguardsize(&attr, dispatch_queue->stack_guard_size);
+  }
+  if (dispatch_queue->sched_policy != SCHED_OTHER) {
+    struct sched_param param;
+    param.sched_priority = dispatch_queue->sched_priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, dispatch_queue->sched_policy);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+
+  err = pthread_create(&worker->thread, &attr, worker_main, worker);
+  if (err == EPERM) {
+    // real-time scheduling requires CAP_SYS_NICE or RLIMIT_RTPRIO, fall back
+    // to the default scheduling for this and all later workers
+    dispatch_printf("worker_create: real-time scheduling not permitted\n");
+    dispatch_queue->sched_policy = SCHED_OTHER;
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    err = pthread_create(&worker->thread, &attr, worker_main, worker);
+  }
+  pthread_attr_destroy(&attr);
+
+  if (err) dispatch_printf("worker_create: pthread_create failed: %d\n", err);
+  return (err == 0);
+}
+
+// Joins and deletes the workers that have retired.  The lock is released
+// while joining, so a retiring worker is never waited on by a thread that
+// holds the lock it needs.
+// NOTE: the caller must hold the queue lock
+static void worker_reap(dispatch_host_queue_t *dispatch_queue,
+                        std::unique_lock<std::mutex> &lock) {
+  // NOTE: dispatch_queue_delete joins every worker once the queue quits
+  if (dispatch_queue->retired.empty() || dispatch_queue->quit) return;
+
+  std::vector<dispatch_host_worker_t *> retired;
+  retired.swap(dispatch_queue->retired);
+  lock.unlock();
+  for (dispatch_host_worker_t *worker : retired) {
+    pthread_join(worker->thread, nullptr);
+  }
+  lock.lock();
+
+  for (dispatch_host_worker_t *worker : retired) {
+    dispatch_queue->scratch_high_watermark =
+        std::max(dispatch_queue->scratch_high_watermark,
+                 scratch_arena_high_watermark(&worker->scratch));
+    dispatch_queue->workers.erase(std::find(dispatch_queue->workers.begin(),
+                                            dispatch_queue->workers.end(),
+                                            worker));
+    allocator_delete(dispatch_queue->allocator, worker);
+  }
+}
+
+// Starts a worker, returns false if its thread could not be created or the
+// queue is quitting
+// NOTE: the caller must hold the queue lock, which is released while the
+//       retired workers are joined, so the caller's checks may be stale by
+//       one worker
+static bool worker_start(dispatch_host_queue_t *dispatch_queue,
+                         std::unique_lock<std::mutex> &lock) {
+  dispatch_printf("worker_start: %u   worker=%u\n", (size_t)dispatch_queue,
+                  dispatch_queue->live_count);
+
+  worker_reap(dispatch_queue, lock);
+  // NOTE: a stop hook may add tasks while the queue is deleted
+  if (dispatch_queue->quit ||
+      dispatch_queue->live_count >= worker_limit(dispatch_queue))
+    return false;
+
+  // pinned workers take the first CPU in placement order with the fewest
+  // workers, so workers that retire leave a gap that is filled first
+  int slot = -1;
+  if (dispatch_queue->pinned) {
+    auto it = std::min_element(dispatch_queue->cpu_workers.begin(),
+                               dispatch_queue->cpu_workers.end());
+    slot = it - dispatch_queue->cpu_workers.begin();
+    (*it)++;
+  }
+
+  dispatch_host_worker_t *worker =
+      allocator_new<dispatch_host_worker_t>(dispatch_queue->allocator);
+  worker->queue = dispatch_queue;
+  worker->slot = slot;
+  worker->exited = false;
+  worker->cache_domain = -1;
+  if (slot >= 0) {
+    worker->cache_domain = topology_cache_domain(dispatch_queue->cpus[slot]);
+  }
+  worker->shard = 0;
+  if (dispatch_queue->shards.size()) {
+    // pinned workers are placed in cache domain order, so neighbouring
+    // shards are homes to workers that share a cache
+    worker->shard = (slot >= 0 ? slot : dispatch_queue->live_count) %
+                    dispatch_queue->shards.size();
+    __atomic_store_n(&dispatch_queue->shards[worker->shard]->cache_domain,
+                     worker->cache_domain, __ATOMIC_RELAXED);
+  }
+  worker->next = nullptr;
+  worker->next_seen = nullptr;
+  worker->local_runs = 0;
+  worker->local_count = 0;
+  // the worker allocates its arena, until then it is empty
+  scratch_arena_place(&worker->scratch, nullptr, 0);
+
+  __atomic_add_fetch(&dispatch_queue->live_count, 1, __ATOMIC_SEQ_CST);
+  if (!worker_create(worker)) {
+    // the queue carries on with the workers it has
+    __atomic_sub_fetch(&dispatch_queue->live_count, 1, __ATOMIC_SEQ_CST);
+    if (slot >= 0) dispatch_queue->cpu_workers[slot]--;
+    allocator_delete(dispatch_queue->allocator, worker);
+    return false;
+  }
+  dispatch_queue->workers.push_back(worker);
+  return true;
+}
+
+// Puts a task added by one of the worker's own tasks in the worker's next
+// slot.  The task it displaces goes on the local stack where idle workers
+// can steal it, the oldest task of a full stack goes to the deque.  The
+// watcher steals the task in the next slot if the worker's task runs long.
+// NOTE: must be called from the worker's own thread
+static void local_add(dispatch_host_worker_t *worker, dispatch_task_t *task,
+                      TaskCompletion *completion) {
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+
+  if (completion) {
+    task->private_data = completion;
+  }
+  // NOTE: the exchange publishes the task to the watcher
+  dispatch_task_t *displaced =
+      __atomic_exchange_n(&worker->next, task, __ATOMIC_SEQ_CST);
+  if (displaced == nullptr) {
+    if (!__atomic_load_n(&dispatch_queue->unwatched, __ATOMIC_SEQ_CST)) return;
+    if (__atomic_load_n(&dispatch_queue->idle_count, __ATOMIC_SEQ_CST)) {
+      // wake the idle workers, the watcher among them times the slot
+      worker_wake(dispatch_queue);
+    } else if (__atomic_load_n(&dispatch_queue->live_count,
+                               __ATOMIC_SEQ_CST) <
+               dispatch_queue->thread_count) {
+      // start a worker that can watch the slot
+      std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+      if (dispatch_queue->idle_count == 0 &&
+          dispatch_queue->live_count < worker_limit(dispatch_queue)) {
+        worker_start(dispatch_queue, lock);
+      }
+    }
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  if (worker->local_count == DISPATCH_WORKER_LOCAL_SIZE) {
+    deque_push(dispatch_queue, local_take_oldest(worker));
+  }
+  worker->local[worker->local_count++] = displaced;
+  dispatch_queue->local_count++;
+
+  // start another worker if there is more work waiting than idle workers to
+  // steal it
+  if ((deque_size(dispatch_queue) + dispatch_queue->local_count >
+       dispatch_queue->idle_count) &&
+      (dispatch_queue->live_count < worker_limit(dispatch_queue))) {
+    worker_start(dispatch_queue, lock);
+  }
+  lock.unlock();
+
+  worker_wake(dispatch_queue, 1);
+}
+
+// Returns the calling worker's local tasks to the deque before it waits, so
+// a task is not left waiting on a task stuck behind it
+static void worker_flush_local() {
+  dispatch_host_worker_t *worker = worker_self;
+
+  if (worker == nullptr) return;
+
+  dispatch_host_queue_t *dispatch_queue = worker->queue;
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  bool returned = local_return(worker);
+  if ((deque_size(dispatch_queue) > dispatch_queue->idle_count) &&
+      (dispatch_queue->live_count < worker_limit(dispatch_queue))) {
+    worker_start(dispatch_queue, lock);
+  }
+  lock.unlock();
+
+  if (returned) worker_wake(dispatch_queue);
+}
+
+// Returns the next number from the calling thread's xorshift generator
+static uint32_t thread_random() {
+  static thread_local uint32_t state = 0;
+
+  // seeded from the address of the state, which differs between threads
+  if (state == 0) {
+    state = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&state)) | 1;
+  }
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Wakes or starts a worker for a task that was added without the queue
+// lock.  Idle workers are woken without the lock, it is only taken if there
+// are more tasks than idle workers and a worker to start.
+// NOTE: the task must be counted first, see worker_wait
+static void unlocked_notify(dispatch_host_queue_t *dispatch_queue) {
+  worker_wake(dispatch_queue, 1);
+
+  if (unlocked_tasks(dispatch_queue) <=
+          __atomic_load_n(&dispatch_queue->idle_count, __ATOMIC_SEQ_CST) ||
+      __atomic_load_n(&dispatch_queue->live_count, __ATOMIC_SEQ_CST) >=
+          dispatch_queue->thread_count)
+    return;
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  if ((unlocked_tasks(dispatch_queue) > dispatch_queue->idle_count) &&
+      (dispatch_queue->live_count < worker_limit(dispatch_queue))) {
+    worker_start(dispatch_queue, lock);
+  }
+}
+
+// Adds the task to the shorter of two randomly chosen shards
+static void shard_add(dispatch_host_queue_t *dispatch_queue,
+                      dispatch_task_t *task) {
+  size_t count = dispatch_queue->shards.size();
+  dispatch_host_shard_t *shard =
+      dispatch_queue->shards[thread_random() % count];
+  dispatch_host_shard_t *other =
+      dispatch_queue->shards[thread_random() % count];
+
+  if (__atomic_load_n(&other->length, __ATOMIC_RELAXED) <
+      __atomic_load_n(&shard->length, __ATOMIC_RELAXED))
+    shard = other;
+
+  std::unique_lock<std::mutex> shard_lock(shard->lock);
+  shard->deque.push_back(task);
+  __atomic_store_n(&shard->length, shard->deque.size(), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&dispatch_queue->sharded_count, 1, __ATOMIC_SEQ_CST);
+  shard_lock.unlock();
+
+  unlocked_notify(dispatch_queue);
+}
+
+// Returns the calling thread's id, ids are never reused
+static uint64_t thread_id() {
+  static uint64_t last_id = 0;
+  static thread_local uint64_t id = 0;
+
+  if (id == 0) id = __atomic_add_fetch(&last_id, 1, __ATOMIC_RELAXED);
+  return id;
+}
+
+// Returns true if the calling thread is the ring's producer, the first
+// thread to add to the ring becomes its producer
+static bool ring_is_producer(dispatch_host_ring_t *ring) {
+  uint64_t self = thread_id();
+  uint64_t producer = 0;
+
+  if (__atomic_compare_exchange_n(&ring->producer, &producer, self, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    return true;
+  return (producer == self);
+}
+
+// Adds the task to the ring, returns false if the ring is full.  Wait-free,
+// but only one thread may add to the ring.
+static bool ring_add(dispatch_host_ring_t *ring, dispatch_task_t *task) {
+  size_t tail = ring->tail;
+
+  // NOTE: the head is only read again once the ring looks full
+  if (tail - ring->head_seen > ring->mask) {
+    ring->head_seen = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - ring->head_seen > ring->mask) return false;
+  }
+  __atomic_store_n(&ring->tasks[tail & ring->mask], task, __ATOMIC_RELAXED);
+  // publish the task, it is counted before the idle workers are read
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+  return true;
+}
+
+static void task_add(dispatch_host_queue_t *dispatch_queue,
+                     dispatch_task_t *task, TaskCompletion *completion);
+
+// Runs the next task of a logical queue in one of the target's workers
+DISPATCH_TASK_FUNCTION
+static void queue_drain(void *arg) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(arg);
+  dispatch_task_t *task = nullptr;
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  if (deque_size(dispatch_queue)) {
+    task = deque_pop(dispatch_queue);
+    dispatch_queue->busy_count++;
+  }
+  if (deque_size(dispatch_queue)) {
+    // reschedule behind the other queues' work so the target's workers are
+    // shared fairly, another worker may pick up the next task concurrently
+    task_add(dispatch_queue->target, &dispatch_queue->drain_task, nullptr);
+  } else {
+    dispatch_queue->scheduled = false;
+  }
+  lock.unlock();
+
+  if (task) {
+    task_run(task);
+    lock.lock();
+    dispatch_queue->busy_count--;
+  } else {
+    lock.lock();
+  }
+  if (dispatch_queue->busy_count == 0 && deque_size(dispatch_queue) == 0) {
+    // notify anyone waiting for the queue to drain
+    dispatch_queue->idle_cv.notify_all();
+  }
+}
+
+static void task_add(dispatch_host_queue_t *dispatch_queue,
+                     dispatch_task_t *task,
+                     TaskCompletion *completion = nullptr) {
+  if (completion) {
+    task->private_data = completion;
+  }
+
+  // the single producer adds to the ring, the queue's own workers and a
+  // full ring use the deque
+  dispatch_host_worker_t *worker = worker_self;
+  if (dispatch_queue->ring &&
+      !(worker && worker->queue == dispatch_queue)) {
+    // NOTE: only checked if dispatch_assert is enabled
+    dispatch_assert(ring_is_producer(dispatch_queue->ring));
+    if (ring_add(dispatch_queue->ring, task)) {
+      unlocked_notify(dispatch_queue);
+      return;
+    }
+  } else if (dispatch_queue->shards.size()) {
+    shard_add(dispatch_queue, task);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  deque_push(dispatch_queue, task);
+
+  if (dispatch_queue->target) {
+    // logical queue, make sure the target will drain this queue
+    bool schedule = !dispatch_queue->scheduled;
+    dispatch_queue->scheduled = true;
+    lock.unlock();
+
+    if (schedule) task_add(dispatch_queue->target, &dispatch_queue->drain_task);
+    return;
+  }
+
+  // workers are started on demand, start another one if there is more work
+  // waiting than idle workers to take it
+  if ((deque_size(dispatch_queue) > dispatch_queue->idle_count) &&
+      (dispatch_queue->live_count < worker_limit(dispatch_queue))) {
+    worker_start(dispatch_queue, lock);
+  }
+  // manual unlocking is done before notifying, to avoid waking up
+  // the waiting thread only to block again (see notify_one for details)
+  lock.unlock();
+
+  worker_wake(dispatch_queue, 1);
+}
+
+dispatch_queue_t *dispatch_queue_create(size_t length, size_t thread_count,
+                                        size_t thread_stack_size,
+                                        size_t thread_priority) {
+  dispatch_queue_attr_t attr;
+
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = thread_stack_size;
+  attr.thread_priority = thread_priority;
+
+  return dispatch_queue_create_with_attr(length, thread_count, &attr);
+}
+
+// Applies the attributes to a new queue that owns its workers
+static void queue_configure(dispatch_host_queue_t *dispatch_queue,
+                            size_t length, size_t thread_count,
+                            const dispatch_queue_attr_t *attr) {
+  dispatch_queue->thread_count = thread_count;
+  dispatch_queue->workers.reserve(thread_count);
+  dispatch_queue->idle_timeout = std::chrono::milliseconds(0);
+  dispatch_queue->pool = nullptr;
+  dispatch_queue->target = nullptr;
+
+  // small explicit stacks, rounded up to whole pages, keep the footprint of
+  // many workers down
+  dispatch_queue->stack_size = 0;
+  dispatch_queue->stack_guard_size = 0;
+  if (attr->thread_stack_size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t stack_size = attr->thread_stack_size * sizeof(void *);
+    stack_size = std::max<size_t>(stack_size, PTHREAD_STACK_MIN);
+    stack_size = (stack_size + page_size - 1) / page_size * page_size;
+    if (attr->thread_stack_guard) dispatch_queue->stack_guard_size = page_size;
+    // NOTE: the guard page is taken from the stack size
+    dispatch_queue->stack_size = stack_size + dispatch_queue->stack_guard_size;
+  }
+
+  // real-time priorities are clamped to the range of the policy
+  switch (attr->thread_policy) {
+    case DISPATCH_SCHED_FIFO:
+      dispatch_queue->sched_policy = SCHED_FIFO;
+      break;
+    case DISPATCH_SCHED_RR:
+      dispatch_queue->sched_policy = SCHED_RR;
+      break;
+    default:
+      dispatch_queue->sched_policy = SCHED_OTHER;
+      break;
+  }
+  dispatch_queue->sched_priority = 0;
+  if (dispatch_queue->sched_policy != SCHED_OTHER) {
+    int min = sched_get_priority_min(dispatch_queue->sched_policy);
+    int max = sched_get_priority_max(dispatch_queue->sched_policy);
+    dispatch_queue->sched_priority = static_cast<int>(
+        std::min<size_t>(std::max<size_t>(attr->thread_priority, min), max));
+  }
+  dispatch_queue->nice = attr->thread_nice;
+  dispatch_queue->start_hook = attr->worker_start;
+  dispatch_queue->stop_hook = attr->worker_stop;
+  dispatch_queue->hook_argument = attr->worker_argument;
+  dispatch_queue->scratch_size = attr->scratch_size;
+  task_table_init(&dispatch_queue->table, attr->task_table_length,
+                  dispatch_queue->allocator);
+  // the ring holds the queue's length, rounded up to a power of two
+  dispatch_queue->ring = nullptr;
+  if (attr->single_producer) {
+    size_t capacity = 2;
+    while (capacity < length) capacity *= 2;
+    dispatch_host_ring_t *ring =
+        allocator_new<dispatch_host_ring_t>(dispatch_queue->allocator);
+    ring->tasks = static_cast<dispatch_task_t **>(allocator_malloc(
+        dispatch_queue->allocator, sizeof(dispatch_task_t *) * capacity));
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->head_seen = 0;
+    ring->producer = 0;
+    dispatch_queue->ring = ring;
+  }
+  // a single shard is the queue's own deque, a single producer does not
+  // need shards
+  if (attr->shard_count > 1 && !attr->single_producer) {
+    for (size_t i = 0; i < attr->shard_count; i++) {
+      dispatch_host_shard_t *shard =
+          allocator_new<dispatch_host_shard_t>(dispatch_queue->allocator);
+      shard->length = 0;
+      shard->cache_domain = -1;
+      dispatch_queue->shards.push_back(shard);
+    }
+  }
+
+  // restrict the workers to the CPU set
+  std::vector<int> cpu_set;
+  if (attr->cpu_set) {
+    cpu_set.assign(attr->cpu_set, attr->cpu_set + attr->cpu_set_size);
+  }
+  dispatch_queue->pinned = (attr->placement == DISPATCH_PLACEMENT_TOPOLOGY);
+  if (dispatch_queue->pinned) {
+    dispatch_queue->cpus = topology_placement(cpu_set);
+    // NOTE: the topology is unknown if /sys is not available, so the workers
+    //       are left to float
+    dispatch_queue->pinned = dispatch_queue->cpus.size();
+    dispatch_queue->cpu_workers.assign(dispatch_queue->cpus.size(), 0);
+  } else {
+    dispatch_queue->cpus = cpu_set;
+  }
+}
+
+dispatch_queue_t *dispatch_queue_create_with_attr(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr) {
+  dispatch_host_queue_t *dispatch_queue;
+  dispatch_assert(attr);
+
+  dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
+                  thread_count);
+
+  const dispatch_allocator_t *allocator = allocator_resolve(attr->allocator);
+  dispatch_queue = allocator_new<dispatch_host_queue_t>(allocator);
+  dispatch_queue->caller_storage = false;
+  dispatch_queue->allocator = allocator;
+  queue_configure(dispatch_queue, length, thread_count, attr);
+
+  // initialize the queue
+  dispatch_queue_init(dispatch_queue, attr->thread_priority);
+
+  dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
+
+  return dispatch_queue;
+}
+
+size_t dispatch_queue_storage_size(size_t length, size_t thread_count,
+                                   const dispatch_queue_attr_t *attr) {
+  dispatch_assert(attr);
+
+  // NOTE: the task lists and workers are allocated by the queue, so only the
+  //       queue object is placed in the storage.  The storage is aligned like
+  //       malloc, so there is room to align the queue to a cache line.
+  return sizeof(dispatch_host_queue_t) + alignof(dispatch_host_queue_t) -
+         alignof(std::max_align_t);
+}
+
+dispatch_queue_t *dispatch_queue_create_with_storage(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr,
+    void *storage) {
+  dispatch_host_queue_t *dispatch_queue;
+  dispatch_assert(attr);
+  dispatch_assert(storage);
+  dispatch_assert(reinterpret_cast<uintptr_t>(storage) %
+                      alignof(std::max_align_t) ==
+                  0);
+
+  dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
+                  thread_count);
+
+  dispatch_queue =
+      new (align_for<dispatch_host_queue_t>(storage)) dispatch_host_queue_t;
+  dispatch_queue->caller_storage = true;
+  dispatch_queue->allocator = allocator_resolve(attr->allocator);
+  queue_configure(dispatch_queue, length, thread_count, attr);
+
+  // initialize the queue
+  dispatch_queue_init(dispatch_queue, attr->thread_priority);
+
+  dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
+
+  return dispatch_queue;
+}
+
+static dispatch_host_queue_t *logical_queue_create(dispatch_host_pool_t *pool,
+                                                   size_t length) {
+  dispatch_host_queue_t *dispatch_queue;
+
+  // create the pool's worker queue with the first logical queue
+  std::unique_lock<std::mutex> lock(pool->lock);
+  if (pool->refs++ == 0) {
+    size_t thread_count = pool->thread_count;
+    if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0) thread_count = 1;
+    pool->queue = static_cast<dispatch_host_queue_t *>(
+        dispatch_queue_create(length, thread_count, 0, 0));
+    pool->queue->idle_timeout =
+        std::chrono::milliseconds(pool->idle_timeout_ms);
+  }
+  lock.unlock();
+
+  const dispatch_allocator_t *allocator = allocator_resolve(nullptr);
+  dispatch_queue = allocator_new<dispatch_host_queue_t>(allocator);
+  dispatch_queue->caller_storage = false;
+  dispatch_queue->allocator = allocator;
+  dispatch_queue->thread_count = 0;
+  dispatch_queue->idle_timeout = std::chrono::milliseconds(0);
+  dispatch_queue->pinned = false;
+  dispatch_queue->stack_size = 0;
+  dispatch_queue->stack_guard_size = 0;
+  dispatch_queue->sched_policy = SCHED_OTHER;
+  dispatch_queue->sched_priority = 0;
+  dispatch_queue->nice = 0;
+  dispatch_queue->start_hook = nullptr;
+  dispatch_queue->stop_hook = nullptr;
+  dispatch_queue->hook_argument = nullptr;
+  dispatch_queue->scratch_size = 0;
+  task_table_init(&dispatch_queue->table, 0, dispatch_queue->allocator);
+  dispatch_queue->ring = nullptr;
+  dispatch_queue->pool = pool;
+  dispatch_queue->target = pool->queue;
+  dispatch_task_init(&dispatch_queue->drain_task, queue_drain, dispatch_queue,
+                     false);
+  dispatch_queue->drain_task.private_data =
+      static_cast<TaskCompletion *>(&persistent_task);
+
+  // initialize the queue
+  dispatch_queue_init(dispatch_queue, 0);
+
+  return dispatch_queue;
+}
+
+static void logical_queue_delete(dispatch_host_queue_t *dispatch_queue) {
+  dispatch_host_pool_t *pool = dispatch_queue->pool;
+
+  // wait until the waiting tasks have drained, so none are leaked and
+  // their waiters are released, and the target no longer references this
+  // queue
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  dispatch_queue->idle_cv.wait(lock, [dispatch_queue] {
+    return (!dispatch_queue->scheduled && dispatch_queue->busy_count == 0 &&
+            deque_size(dispatch_queue) == 0);
+  });
+  lock.unlock();
+  allocator_delete(dispatch_queue->allocator, dispatch_queue);
+
+  // delete the pool's worker queue with the last logical queue
+  std::unique_lock<std::mutex> pool_lock(pool->lock);
+  if (--pool->refs == 0) {
+    dispatch_queue_delete(pool->queue);
+    pool->queue = nullptr;
+  }
+}
+
+// Returns the queue that the task should be added to
+static dispatch_host_queue_t *task_queue(dispatch_host_queue_t *dispatch_queue,
+                                         dispatch_task_t *task) {
+  if (!task->blocking || dispatch_queue->pool == &blocking_pool)
+    return dispatch_queue;
+
+  // send blocking tasks to this queue's logical queue on the blocking pool
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  if (dispatch_queue->blocking_queue == nullptr) {
+    dispatch_queue->blocking_queue = logical_queue_create(&blocking_pool, 0);
+  }
+  return dispatch_queue->blocking_queue;
+}
+
+dispatch_queue_t *dispatch_queue_create_shared(size_t length) {
+  dispatch_host_queue_t *dispatch_queue;
+
+  dispatch_printf("dispatch_queue_create_shared: length=%d\n", length);
+
+  dispatch_queue = logical_queue_create(&shared_pool, length);
+
+  dispatch_printf("dispatch_queue_create_shared: %u\n",
+                  (size_t)dispatch_queue);
+
+  return dispatch_queue;
+}
+
+void dispatch_queue_init(dispatch_queue_t *ctx, size_t thread_priority) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_init: %u\n", (size_t)dispatch_queue);
+
+  // NOTE: workers are not started here, they are started on demand when
+  //       tasks are added or by dispatch_queue_prewarm
+  dispatch_queue->quit = false;
+  dispatch_queue->live_count = 0;
+  dispatch_queue->idle_count = 0;
+  dispatch_queue->busy_count = 0;
+  dispatch_queue->blocked_count = 0;
+  dispatch_queue->broadcast_count = 0;
+  dispatch_queue->local_count = 0;
+  dispatch_queue->sharded_count = 0;
+  dispatch_queue->wake = 0;
+  dispatch_queue->scratch_high_watermark = 0;
+  dispatch_queue->scheduled = false;
+  dispatch_queue->watcher = nullptr;
+  dispatch_queue->unwatched = true;
+  dispatch_queue->blocking_queue = nullptr;
+}
+
+void dispatch_queue_prewarm(dispatch_queue_t *ctx) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_prewarm: %u\n", (size_t)dispatch_queue);
+
+  if (dispatch_queue->target) {
+    // logical queues do not have workers of their own
+    dispatch_queue_prewarm(dispatch_queue->target);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  while (dispatch_queue->live_count < dispatch_queue->thread_count) {
+    if (!worker_start(dispatch_queue, lock)) break;
+  }
+}
+
+dispatch_task_t *dispatch_queue_broadcast(dispatch_queue_t *ctx,
+                                          dispatch_function_t function,
+                                          void *argument) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(function);
+
+  dispatch_printf("dispatch_queue_broadcast: %u\n", (size_t)dispatch_queue);
+
+  if (dispatch_queue->target) {
+    // logical queues do not have workers of their own
+    return dispatch_queue_broadcast(dispatch_queue->target, function, argument);
+  }
+
+  dispatch_task_t *task = allocator_task_create(dispatch_queue->allocator,
+                                                function, argument, true);
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  while (dispatch_queue->live_count < dispatch_queue->thread_count) {
+    if (!worker_start(dispatch_queue, lock)) break;
+  }
+
+  // every live worker performs the task once and signals the counter, the
+  // workers that have exited but not been joined are skipped
+  EventCounter *counter = EventCounter::Create(dispatch_queue->live_count,
+                                               dispatch_queue->allocator);
+  task->private_data = static_cast<TaskCompletion *>(counter);
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    if (worker->exited) continue;
+    worker->broadcasts.push_back(task);
+    dispatch_queue->broadcast_count++;
+  }
+  lock.unlock();
+
+  worker_wake(dispatch_queue);
+
+  return task;
+}
+
+void dispatch_worker_blocking_begin() {
+  dispatch_host_queue_t *dispatch_queue = worker_queue;
+
+  // nothing to compensate for if not called from a worker
+  if (dispatch_queue == nullptr) return;
+
+  dispatch_printf("dispatch_worker_blocking_begin: %u\n",
+                  (size_t)dispatch_queue);
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  dispatch_queue->blocked_count++;
+  // the rest of this worker's batch is returned to the deque, in order, so
+  // it is not stuck behind this task, and so are its local tasks
+  dispatch_host_worker_t *worker = worker_self;
+  bool returned = false;
+  if (worker) {
+    while (worker->batch_count > worker->batch_next) {
+      deque_push_front(dispatch_queue, worker->batch[--worker->batch_count]);
+      returned = true;
+    }
+    if (local_return(worker)) returned = true;
+  }
+  // start a temporary worker if there is work waiting that would otherwise
+  // be stuck behind this one
+  if ((deque_size(dispatch_queue) > dispatch_queue->idle_count) &&
+      (dispatch_queue->live_count < worker_limit(dispatch_queue))) {
+    worker_start(dispatch_queue, lock);
+  }
+  lock.unlock();
+
+  if (returned) worker_wake(dispatch_queue);
+}
+
+void dispatch_worker_blocking_end() {
+  dispatch_host_queue_t *dispatch_queue = worker_queue;
+
+  if (dispatch_queue == nullptr) return;
+
+  dispatch_printf("dispatch_worker_blocking_end: %u\n",
+                  (size_t)dispatch_queue);
+
+  // surplus workers exit once they finish their current task
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  dispatch_assert(dispatch_queue->blocked_count > 0);
+  dispatch_queue->blocked_count--;
+}
+
+void *dispatch_worker_context() { return worker_context; }
+
+scratch_arena_t *scratch_arena_current() { return worker_scratch; }
+
+dispatch_task_t *dispatch_task_current() { return worker_task; }
+
+size_t dispatch_queue_scratch_high_watermark(dispatch_queue_t *ctx) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_scratch_high_watermark: %u\n",
+                  (size_t)dispatch_queue);
+
+  // logical queues do not have workers of their own
+  if (dispatch_queue->target)
+    return dispatch_queue_scratch_high_watermark(dispatch_queue->target);
+
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  size_t high_watermark = dispatch_queue->scratch_high_watermark;
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    high_watermark = std::max(high_watermark,
+                              scratch_arena_high_watermark(&worker->scratch));
+  }
+  return high_watermark;
+}
+
+dispatch_task_t *dispatch_queue_task_create(dispatch_queue_t *ctx,
+                                            dispatch_function_t function,
+                                            void *argument, bool waitable) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(function);
+
+  dispatch_host_task_table_t *table = &dispatch_queue->table;
+  dispatch_task_t *task = static_cast<dispatch_task_t *>(
+      task_table_malloc(table, sizeof(dispatch_task_t)));
+
+  // fall back to the queue's allocator when the table is full
+  if (task == nullptr) {
+    return allocator_task_create(dispatch_queue->allocator, function, argument,
+                                 waitable);
+  }
+
+  dispatch_task_init(task, function, argument, waitable);
+  task->allocator = &table->allocator;
+
+  dispatch_printf("dispatch_queue_task_create: %u   task=%u\n",
+                  (size_t)dispatch_queue, (size_t)task);
+
+  return task;
+}
+
+void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(task);
+
+  dispatch_printf("dispatch_queue_add_task: %u\n", (size_t)dispatch_queue);
+
+  dispatch_queue = task_queue(dispatch_queue, task);
+
+  EventCounter *counter = nullptr;
+
+  if (task->waitable) {
+    counter = EventCounter::Create(1, dispatch_queue->allocator);
+  }
+
+  // a task added by one of the queue's own tasks is performed next by the
+  // same worker, while the data they share is still in its cache
+  dispatch_host_worker_t *worker = worker_self;
+  if (worker && worker->queue == dispatch_queue) {
+    local_add(worker, task, counter);
+    return;
+  }
+  task_add(dispatch_queue, task, counter);
+}
+
+void dispatch_queue_group_add(dispatch_queue_t *ctx, dispatch_group_t *group) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(group);
+
+  dispatch_printf("dispatch_queue_group_add: %u   group=%u\n",
+                  (size_t)dispatch_queue, (size_t)group);
+
+  if (group->waitable) {
+    // the tasks leave the group as they finish
+    __atomic_add_fetch(&group->pending, group->count, __ATOMIC_RELAXED);
+  }
+
+  for (int i = 0; i < group->count; i++) {
+    dispatch_task_t *task = group_task(group, i);
+    task_add(task_queue(dispatch_queue, task), task);
+  }
+}
+
+// Returns the steady clock time of the deadline
+static std::chrono::steady_clock::time_point deadline_time(
+    dispatch_time_t deadline) {
+  // NOTE: clamp so the conversion to the clock's duration can not overflow,
+  //       the clock counts from boot so the clamp must be far in the future
+  const dispatch_time_t max_deadline =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::duration::max())
+          .count();
+  return std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::microseconds(std::min(deadline, max_deadline))));
+}
+
+dispatch_time_t dispatch_time_now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Waits on the completion, returns false if the deadline passed
+static bool completion_wait(EventCounter *counter, dispatch_time_t deadline) {
+  worker_flush_local();
+  if (deadline == DISPATCH_TIME_FOREVER) {
+    counter->Wait();
+    return true;
+  }
+  return counter->WaitUntil(deadline_time(deadline));
+}
+
+event_counter_t *event_counter_create(size_t count,
+                                      const dispatch_allocator_t *allocator) {
+  return EventCounter::Create<event_counter_t>(count, allocator);
+}
+
+void event_counter_signal(event_counter_t *counter) {
+  dispatch_assert(counter);
+
+  counter->Signal();
+}
+
+void event_counter_wait(event_counter_t *counter) {
+  dispatch_assert(counter);
+
+  worker_flush_local();
+  counter->Wait();
+}
+
+bool event_counter_wait_until(event_counter_t *counter,
+                              dispatch_time_t deadline) {
+  dispatch_assert(counter);
+
+  return completion_wait(counter, deadline);
+}
+
+void event_counter_reset(event_counter_t *counter, size_t count) {
+  dispatch_assert(counter);
+
+  counter->Reset(count);
+}
+
+void event_counter_delete(event_counter_t *counter) {
+  dispatch_assert(counter);
+
+  EventCounter::Delete(counter);
+}
+
+void dispatch_queue_task_wait(dispatch_queue_t *ctx, dispatch_task_t *task) {
+  dispatch_queue_task_wait_until(ctx, task, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_task_wait_until(
+    dispatch_queue_t *ctx, dispatch_task_t *task, dispatch_time_t deadline) {
+  dispatch_assert(task);
+  dispatch_assert(task->waitable);
+
+  dispatch_printf("dispatch_queue_task_wait: %u   task=%u\n", (size_t)ctx,
+                  (size_t)task);
+
+  EventCounter *counter = static_cast<EventCounter *>(
+      static_cast<TaskCompletion *>(task->private_data));
+  // wait on the task's semaphore which signals that it is complete
+  if (!completion_wait(counter, deadline)) return DISPATCH_WAIT_TIMEOUT;
+  // the contract is that the dispatch queue must delete waitable tasks
+  EventCounter::Delete(counter);
+  dispatch_task_delete(task);
+
+  return DISPATCH_WAIT_SUCCESS;
+}
+
+void dispatch_wait_any(dispatch_task_t **tasks, size_t count, size_t *index) {
+  dispatch_assert(tasks);
+  dispatch_assert(index);
+
+  dispatch_printf("dispatch_wait_any: %u   count=%u\n", (size_t)tasks, count);
+
+  CompletionWaiter waiter;
+  bool complete = false;
+  size_t first = count;
+
+  // register one waiter with all of the tasks
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == nullptr) continue;
+    dispatch_assert(tasks[i]->waitable);
+    EventCounter *counter = static_cast<EventCounter *>(
+        static_cast<TaskCompletion *>(tasks[i]->private_data));
+    if (counter->Register(&waiter)) complete = true;
+  }
+  if (!complete) {
+    worker_flush_local();
+    waiter.Wait(0);
+  }
+
+  // NOTE: once unregistered, no counter will notify the waiter
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == nullptr) continue;
+    EventCounter *counter = static_cast<EventCounter *>(
+        static_cast<TaskCompletion *>(tasks[i]->private_data));
+    if (counter->Unregister() && first == count) first = i;
+  }
+  dispatch_assert(first < count);
+
+  // the contract is that the dispatch queue must delete waitable tasks
+  EventCounter::Delete(static_cast<EventCounter *>(
+      static_cast<TaskCompletion *>(tasks[first]->private_data)));
+  dispatch_task_delete(tasks[first]);
+  tasks[first] = nullptr;
+  *index = first;
+}
+
+void dispatch_wait_all(dispatch_task_t **tasks, size_t count) {
+  dispatch_assert(tasks);
+
+  dispatch_printf("dispatch_wait_all: %u   count=%u\n", (size_t)tasks, count);
+
+  CompletionWaiter waiter;
+  uint32_t pending = 0;
+  uint32_t completed = 0;
+
+  // register one waiter with all of the tasks, counting the tasks that
+  // will notify it
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == nullptr) continue;
+    dispatch_assert(tasks[i]->waitable);
+    EventCounter *counter = static_cast<EventCounter *>(
+        static_cast<TaskCompletion *>(tasks[i]->private_data));
+    if (!counter->Register(&waiter)) pending++;
+  }
+  if (completed < pending) worker_flush_local();
+  while (completed < pending) completed = waiter.Wait(completed);
+
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == nullptr) continue;
+    EventCounter *counter = static_cast<EventCounter *>(
+        static_cast<TaskCompletion *>(tasks[i]->private_data));
+    counter->Unregister();
+    // the contract is that the dispatch queue must delete waitable tasks
+    EventCounter::Delete(counter);
+    dispatch_task_delete(tasks[i]);
+    tasks[i] = nullptr;
+  }
+}
+
+void completion_ring_notify(dispatch_completion_t *completion) {
+  if (__atomic_load_n(&completion->waiting, __ATOMIC_SEQ_CST))
+    futex_wake(&completion->events);
+}
+
+size_t dispatch_completion_wait(dispatch_completion_t *completion,
+                                void **arguments, size_t count) {
+  dispatch_assert(completion);
+  dispatch_assert(count > 0);
+
+  dispatch_printf("dispatch_completion_wait: %u\n", (size_t)completion);
+
+  size_t reaped;
+
+  while ((reaped = dispatch_completion_poll(completion, arguments, count)) ==
+         0) {
+    // NOTE: workers only wake the futex while the waiting flag is set, the
+    //       events are read after setting it so no push can be missed
+    __atomic_store_n(&completion->waiting, 1, __ATOMIC_SEQ_CST);
+    uint32_t seen = __atomic_load_n(&completion->events, __ATOMIC_SEQ_CST);
+    reaped = dispatch_completion_poll(completion, arguments, count);
+    if (reaped == 0) {
+      worker_flush_local();
+      futex_wait(&completion->events, seen);
+    }
+    __atomic_store_n(&completion->waiting, 0, __ATOMIC_SEQ_CST);
+    if (reaped) break;
+  }
+
+  return reaped;
+}
+
+void dispatch_queue_wait(dispatch_queue_t *ctx) {
+  dispatch_queue_wait_until(ctx, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_wait_until(dispatch_queue_t *ctx,
+                                                 dispatch_time_t deadline) {
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_wait: %u\n", (size_t)dispatch_queue);
+
+  auto idle = [dispatch_queue] {
+    return (deque_size(dispatch_queue) == 0 &&
+            dispatch_queue->busy_count == 0 &&
+            dispatch_queue->local_count == 0 &&
+            unlocked_tasks(dispatch_queue) == 0 &&
+            dispatch_queue->broadcast_count == 0);
+  };
+
+  // wait for deque to empty and all workers to finish their current task
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  if (deadline == DISPATCH_TIME_FOREVER) {
+    dispatch_queue->idle_cv.wait(lock, idle);
+  } else if (!dispatch_queue->idle_cv.wait_until(lock, deadline_time(deadline),
+                                                 idle)) {
+    return DISPATCH_WAIT_TIMEOUT;
+  }
+  dispatch_host_queue_t *blocking_queue = dispatch_queue->blocking_queue;
+  lock.unlock();
+
+  // wait for the tasks sent to the blocking pool too
+  if (blocking_queue) return dispatch_queue_wait_until(blocking_queue, deadline);
+
+  return DISPATCH_WAIT_SUCCESS;
+}
+
+void dispatch_queue_delete(dispatch_queue_t *ctx) {
+  dispatch_assert(ctx);
+  dispatch_host_queue_t *dispatch_queue =
+      static_cast<dispatch_host_queue_t *>(ctx);
+
+  dispatch_printf("dispatch_queue_delete: %u\n", (size_t)dispatch_queue);
+
+  if (dispatch_queue->blocking_queue) {
+    logical_queue_delete(dispatch_queue->blocking_queue);
+  }
+
+  if (dispatch_queue->pool) {
+    logical_queue_delete(dispatch_queue);
+    return;
+  }
+
+  // signal to all thread workers that it is time to quit
+  std::unique_lock<std::mutex> lock(dispatch_queue->lock);
+  dispatch_queue->quit = true;
+  lock.unlock();
+  worker_wake(dispatch_queue);
+
+  // Wait for threads to finish before we exit
+  for (dispatch_host_worker_t *worker : dispatch_queue->workers) {
+    pthread_join(worker->thread, nullptr);
+    allocator_delete(dispatch_queue->allocator, worker);
+  }
+  task_table_deinit(&dispatch_queue->table, dispatch_queue->allocator);
+  for (dispatch_host_shard_t *shard : dispatch_queue->shards) {
+    allocator_delete(dispatch_queue->allocator, shard);
+  }
+  if (dispatch_queue->ring) {
+    allocator_free(dispatch_queue->allocator, dispatch_queue->ring->tasks);
+    allocator_delete(dispatch_queue->allocator, dispatch_queue->ring);
   }
 
-  // free memory
-  for (size_t i = 0; i < dispatch_queue->thread_ready_semaphores.size(); i++) {
-    delete dispatch_queue->thread_ready_semaphores[i];
+  // free memory, caller storage is owned by the caller
+  if (dispatch_queue->caller_storage) {
+    dispatch_queue->~dispatch_host_queue_t();
+  } else {
+    allocator_delete(dispatch_queue->allocator, dispatch_queue);
   }
-  delete dispatch_queue;
 }
@@ -1,5 +1,6 @@
 // Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
 // XMOS Public License: Version 1
+#include <platform.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,8 @@
 #include <xcore/hwtimer.h>
 #include <xcore/thread.h>
 
+#include "allocator.h"
+#include "completion_ring.h"
 #include "dispatch_config.h"
 #include "dispatch_group.h"
 #include "dispatch_queue.h"
@@ -16,10 +19,22 @@
 #include "dispatch_types.h"
 #include "event_counter.h"
 #include "queue_metal.h"
+#include "scratch_arena.h"
 
 #define DISPATCH_WORKER_BUSY_STATUS (0x0)
 #define DISPATCH_WORKER_READY_STATUS (0x1)
 
+#define DISPATCH_LOGICAL_CORE_COUNT (8)
+
+// most tasks a worker takes from the queue at once
+#ifndef DISPATCH_WORKER_BATCH_SIZE
+#define DISPATCH_WORKER_BATCH_SIZE (4)
+#endif
+
+// alignment of each structure placed in the queue's storage, the thread
+// stacks must be double-word aligned
+#define DISPATCH_STORAGE_ALIGNMENT (8)
+
 //***********************
 //***********************
 //***********************
@@ -33,23 +48,56 @@ struct dispatch_worker_data_struct {
   volatile size_t *status;
   size_t parent;
   queue_t *queue;
+  size_t worker_count;         // number of workers sharing the queue
+  dispatch_task_t *broadcast;  // performed before the queue's tasks
+  dispatch_worker_start_t start_hook;
+  dispatch_worker_stop_t stop_hook;
+  void *hook_argument;
 };
 
+// the context of the worker running on each logical core
+static void *worker_contexts[DISPATCH_LOGICAL_CORE_COUNT];
+// the task being performed on each logical core
+static dispatch_task_t *worker_tasks[DISPATCH_LOGICAL_CORE_COUNT];
+
 static void run_task(dispatch_task_t *task) {
-  dispatch_task_perform(task);
+  // NOTE: read before performing the task, a graph's tasks may not outlive
+  //       their function
+  bool waitable = task->waitable;
+  bool persistent = task->persistent;
+  dispatch_group_t *group = task->group;
+
+  // cancelled tasks are skipped but still signal
+  if (!dispatch_task_is_cancelled(task)) {
+    // NOTE: the caller's thread may perform a task inside its own task
+    int core = get_logical_core_id();
+    dispatch_task_t *previous = worker_tasks[core];
+    worker_tasks[core] = task;
+    dispatch_task_perform(task);
+    worker_tasks[core] = previous;
+  }
 
-  if (task->waitable) {
-    // signal the event counter
-    event_counter_signal((event_counter_t *)task->private_data);
+  if (waitable) {
+    // signal the event counter, a group's tasks are deleted by its wait
+    if (!group) event_counter_signal((event_counter_t *)task->private_data);
+  } else if (persistent) {
+    // the task belongs to a graph or a reusable group, which deletes it
+  } else if (task->completion) {
+    // hand the task to the completion queue's consumer
+    completion_ring_push(task->completion, task);
   } else {
     // the contract is that the worker must delete non-waitable tasks
     dispatch_task_delete(task);
   }
+  // NOTE: the group may be deleted as soon as the task leaves it
+  if (group) dispatch_group_leave(group);
 }
 
 void dispatch_queue_worker(void *param) {
   dispatch_worker_data_t *worker_data = (dispatch_worker_data_t *)param;
   dispatch_task_t *task = NULL;
+  dispatch_task_t *batch[DISPATCH_WORKER_BATCH_SIZE];
+  size_t count;
   chanend_t cend;
 
   queue_t *queue = worker_data->queue;
@@ -59,15 +107,42 @@ void dispatch_queue_worker(void *param) {
   dispatch_printf("dispatch_queue_worker started: parent=%u\n",
                   worker_data->parent);
 
+  // NOTE: the worker data is freed when the queue is deleted, so the stop
+  //       hook is read now
+  dispatch_worker_stop_t stop_hook = worker_data->stop_hook;
+  void *hook_argument = worker_data->hook_argument;
+  int core = get_logical_core_id();
+  worker_contexts[core] = NULL;
+  if (worker_data->start_hook)
+    worker_contexts[core] = worker_data->start_hook(hook_argument);
+
+  // NOTE: the wake count is read before the broadcast is checked, so a
+  //       broadcast that arrives later always ends the receive
+  size_t wake_count = __atomic_load_n(&queue->wake_count, __ATOMIC_SEQ_CST);
+
   for (;;) {
-    if (queue_receive(queue, (void **)&task, cend)) {
+    task = __atomic_exchange_n(&worker_data->broadcast, NULL, __ATOMIC_SEQ_CST);
+    count = DISPATCH_WORKER_BATCH_SIZE;
+    if (task) {
       *status = DISPATCH_WORKER_BUSY_STATUS;
       run_task(task);
       *status = DISPATCH_WORKER_READY_STATUS;
+    } else if (queue_receive_batch(queue, (void **)batch, &count,
+                                   worker_data->worker_count, &wake_count,
+                                   cend)) {
+      // no tasks if woken for a broadcast
+      if (count == 0) continue;
+      // NOTE: a deep queue is drained a few tasks per acquisition of its
+      //       mutex, a broadcast waits for the batch to finish
+      *status = DISPATCH_WORKER_BUSY_STATUS;
+      for (size_t i = 0; i < count; i++) run_task(batch[i]);
+      *status = DISPATCH_WORKER_READY_STATUS;
     } else {
       chanend_free(cend);
       dispatch_printf("dispatch_queue_worker terminating: parent=%u\n",
                       worker_data->parent);
+      if (stop_hook) stop_hook(hook_argument, worker_contexts[core]);
+      worker_contexts[core] = NULL;
       break;
     }
   }
@@ -86,11 +161,16 @@ struct dispatch_xcore_struct {
   size_t length;
   size_t thread_count;
   size_t thread_stack_size;
+  dispatch_worker_start_t start_hook;
+  dispatch_worker_stop_t stop_hook;
+  void *hook_argument;
   queue_t *queue;
   chanend_t cend;
   char *thread_stack;
   size_t *thread_status;
   dispatch_worker_data_t *worker_data;
+  bool owns_storage;  // storage was allocated by dispatch_queue_create
+  const dispatch_allocator_t *allocator;  // allocates the storage and counters
 };
 
 static int busy_workers(dispatch_xcore_queue_t *dispatch_queue) {
@@ -115,36 +195,106 @@ static int busy_workers(dispatch_xcore_queue_t *dispatch_queue) {
 dispatch_queue_t *dispatch_queue_create(size_t length, size_t thread_count,
                                         size_t thread_stack_size,
                                         size_t thread_priority) {
+  dispatch_queue_attr_t attr;
+
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = thread_stack_size;
+  attr.thread_priority = thread_priority;
+
+  return dispatch_queue_create_with_attr(length, thread_count, &attr);
+}
+
+dispatch_queue_t *dispatch_queue_create_with_attr(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr) {
   dispatch_xcore_queue_t *dispatch_queue;
+  void *storage;
+  dispatch_assert(attr);
+
+  // the queue is placed in one allocation, laid out like caller storage
+  storage = allocator_malloc(
+      attr->allocator,
+      dispatch_queue_storage_size(length, thread_count, attr));
+  dispatch_queue = (dispatch_xcore_queue_t *)dispatch_queue_create_with_storage(
+      length, thread_count, attr, storage);
+  dispatch_queue->owns_storage = true;
+
+  return dispatch_queue;
+}
+
+// Returns the offset of the next structure placed in the storage
+static size_t storage_place(size_t *offset, size_t size) {
+  size_t place = (*offset + DISPATCH_STORAGE_ALIGNMENT - 1) &
+                 ~(DISPATCH_STORAGE_ALIGNMENT - 1);
+  *offset = place + size;
+  return place;
+}
+
+// Places the queue's structures in the storage, or only measures the
+// storage if it is NULL.  Returns the size of the storage.
+static size_t storage_layout(char *storage, size_t length, size_t thread_count,
+                             size_t thread_stack_size) {
+  dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)storage;
+  size_t offset = sizeof(dispatch_xcore_queue_t);
+  size_t queue = storage_place(&offset, sizeof(queue_t));
+  // NOTE: the condition variable embeds its spinlock
+  size_t cv = storage_place(&offset, sizeof(condition_variable_t));
+  size_t ring_buffer = storage_place(&offset, sizeof(void *) * length);
+  size_t thread_status = storage_place(&offset, sizeof(size_t) * thread_count);
+  size_t worker_data =
+      storage_place(&offset, sizeof(dispatch_worker_data_t) * thread_count);
+  // NOTE: the stack size is in words
+  size_t thread_stack =
+      storage_place(&offset, thread_stack_size * sizeof(int) * thread_count);
+
+  if (storage) {
+    dispatch_queue->queue = (queue_t *)&storage[queue];
+    queue_init(dispatch_queue->queue, (void **)&storage[ring_buffer],
+               (condition_variable_t *)&storage[cv], length);
+    dispatch_queue->thread_status = (size_t *)&storage[thread_status];
+    dispatch_queue->worker_data =
+        (dispatch_worker_data_t *)&storage[worker_data];
+    dispatch_queue->thread_stack = &storage[thread_stack];
+  }
+
+  return offset;
+}
+
+size_t dispatch_queue_storage_size(size_t length, size_t thread_count,
+                                   const dispatch_queue_attr_t *attr) {
+  dispatch_assert(attr);
+
+  return storage_layout(NULL, length, thread_count, attr->thread_stack_size);
+}
+
+dispatch_queue_t *dispatch_queue_create_with_storage(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr,
+    void *storage) {
+  dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)storage;
+  dispatch_assert(attr);
+  dispatch_assert(storage);
+  dispatch_assert(((size_t)storage % DISPATCH_STORAGE_ALIGNMENT) == 0);
 
   dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
                   thread_count);
 
-  dispatch_queue =
-      (dispatch_xcore_queue_t *)dispatch_malloc(sizeof(dispatch_xcore_queue_t));
+  // place the queue, thread status flags, thread data and thread stacks
+  storage_layout((char *)storage, length, thread_count,
+                 attr->thread_stack_size);
 
   dispatch_queue->length = length;
   dispatch_queue->thread_count = thread_count;
+  dispatch_queue->thread_stack_size = attr->thread_stack_size;
+  dispatch_queue->owns_storage = false;
+  dispatch_queue->allocator = allocator_resolve(attr->allocator);
   dispatch_queue->cend = chanend_alloc();
 
-  // allocate  queue
-  dispatch_queue->queue = queue_create(length);
-
-  // allocate thread status flags
-  dispatch_queue->thread_status =
-      dispatch_malloc(sizeof(size_t) * thread_count);
-
-  // allocate thread data
-  dispatch_queue->worker_data =
-      dispatch_malloc(sizeof(dispatch_worker_data_t) * thread_count);
-
-  // allocate thread stack
-  dispatch_queue->thread_stack_size = thread_stack_size;
-  dispatch_queue->thread_stack =
-      dispatch_malloc(dispatch_queue->thread_stack_size * thread_count);
+  // NOTE: the CPU set, placement and scheduling policy are not supported
+  dispatch_queue->start_hook = attr->worker_start;
+  dispatch_queue->stop_hook = attr->worker_stop;
+  dispatch_queue->hook_argument = attr->worker_argument;
 
   // initialize the queue
-  dispatch_queue_init(dispatch_queue, thread_priority);
+  dispatch_queue_init(dispatch_queue, attr->thread_priority);
 
   dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
 
@@ -165,6 +315,12 @@ void dispatch_queue_init(dispatch_queue_t *ctx, size_t thread_priority) {
     dispatch_queue->worker_data[i].status = &dispatch_queue->thread_status[i];
     dispatch_queue->worker_data[i].parent = (size_t)dispatch_queue;
     dispatch_queue->worker_data[i].queue = dispatch_queue->queue;
+    dispatch_queue->worker_data[i].worker_count = dispatch_queue->thread_count;
+    dispatch_queue->worker_data[i].broadcast = NULL;
+    dispatch_queue->worker_data[i].start_hook = dispatch_queue->start_hook;
+    dispatch_queue->worker_data[i].stop_hook = dispatch_queue->stop_hook;
+    dispatch_queue->worker_data[i].hook_argument =
+        dispatch_queue->hook_argument;
     // launch the thread worker
     run_async(dispatch_queue_worker, (void *)&dispatch_queue->worker_data[i],
               stack_base((void *)&dispatch_queue->thread_stack[stack_offset],
@@ -173,6 +329,81 @@ void dispatch_queue_init(dispatch_queue_t *ctx, size_t thread_priority) {
   }
 }
 
+void dispatch_queue_prewarm(dispatch_queue_t *ctx) {
+  dispatch_assert(ctx);
+
+  // NOTE: bare-metal workers are hardware threads that are all started in
+  //       dispatch_queue_init, so there is nothing to do here
+}
+
+dispatch_task_t *dispatch_queue_broadcast(dispatch_queue_t *ctx,
+                                          dispatch_function_t function,
+                                          void *argument) {
+  dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(function);
+
+  dispatch_printf("dispatch_queue_broadcast: %u\n", (size_t)dispatch_queue);
+
+  dispatch_task_t *task = allocator_task_create(dispatch_queue->allocator,
+                                                function, argument, true);
+  task->private_data = event_counter_create(dispatch_queue->thread_count,
+                                            dispatch_queue->allocator);
+
+  for (int i = 0; i < dispatch_queue->thread_count; i++) {
+    dispatch_task_t **broadcast = &dispatch_queue->worker_data[i].broadcast;
+    dispatch_task_t *expected = NULL;
+    // wait for the worker to take its previous broadcast
+    while (!__atomic_compare_exchange_n(broadcast, &expected, task, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      expected = NULL;
+    }
+  }
+  // end the receive of the workers that are waiting on an empty queue
+  queue_wake(dispatch_queue->queue, dispatch_queue->cend);
+
+  return task;
+}
+
+void dispatch_worker_blocking_begin() {
+  // NOTE: the bare-metal workers are not compensated for blocking
+}
+
+void dispatch_worker_blocking_end() {}
+
+void *dispatch_worker_context() {
+  // NOTE: a logical core runs at most one worker
+  return worker_contexts[get_logical_core_id()];
+}
+
+dispatch_task_t *dispatch_task_current() {
+  // NOTE: a logical core performs one task at a time
+  return worker_tasks[get_logical_core_id()];
+}
+
+scratch_arena_t *scratch_arena_current() {
+  // NOTE: the bare-metal workers do not have scratch arenas
+  return NULL;
+}
+
+size_t dispatch_queue_scratch_high_watermark(dispatch_queue_t *ctx) {
+  dispatch_assert(ctx);
+
+  return 0;
+}
+
+dispatch_task_t *dispatch_queue_task_create(dispatch_queue_t *ctx,
+                                            dispatch_function_t function,
+                                            void *argument, bool waitable) {
+  dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+
+  // NOTE: the task table is not supported, the queue holds 32-bit task
+  //       pointers already
+  return allocator_task_create(dispatch_queue->allocator, function, argument,
+                               waitable);
+}
+
 void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
   dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)ctx;
   dispatch_assert(dispatch_queue);
@@ -182,7 +413,7 @@ void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
 
   if (task->waitable) {
     // create event counter
-    task->private_data = event_counter_create(1);
+    task->private_data = event_counter_create(1, dispatch_queue->allocator);
   }
 
 #if defined(use_callers_thread)
@@ -204,66 +435,120 @@ void dispatch_queue_group_add(dispatch_queue_t *ctx, dispatch_group_t *group) {
   dispatch_printf("dispatch_queue_group_add: %u   group=%u\n",
                   (size_t)dispatch_queue, (size_t)group);
 
-  event_counter_t *counter = NULL;
-
   if (group->waitable) {
-    // create event counter
-    counter = event_counter_create(group->count);
+    // the tasks leave the group as they finish
+    __atomic_add_fetch(&group->pending, group->count, __ATOMIC_RELAXED);
   }
 
   for (int i = 0; i < group->count; i++) {
-    group->tasks[i]->private_data = counter;
+    dispatch_task_t *task = group_task(group, i);
 
 #if defined(use_callers_thread)
     if (busy_workers(dispatch_queue) == dispatch_queue->thread_count) {
       // all the workers are busy and this thread is configured to pitch in
-      run_task(group->tasks[i]);
+      run_task(task);
       continue;
     }
 #endif
 
-    queue_send(dispatch_queue->queue, (void *)group->tasks[i],
-               dispatch_queue->cend);
+    queue_send(dispatch_queue->queue, (void *)task, dispatch_queue->cend);
   }
 }
 
+dispatch_time_t dispatch_time_now() {
+  return get_reference_time() / PLATFORM_REFERENCE_MHZ;
+}
+
+// Returns true if the deadline has passed
+static bool deadline_passed(dispatch_time_t deadline) {
+  if (deadline == DISPATCH_TIME_FOREVER) return false;
+
+  // NOTE: the deadline is converted back to reference timer ticks, which
+  //       wrap, so it is compared with a signed difference
+  uint32_t deadline_ticks = (uint32_t)(deadline * PLATFORM_REFERENCE_MHZ);
+  return ((int32_t)(deadline_ticks - get_reference_time()) <= 0);
+}
+
 void dispatch_queue_task_wait(dispatch_queue_t *ctx, dispatch_task_t *task) {
+  dispatch_queue_task_wait_until(ctx, task, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_task_wait_until(
+    dispatch_queue_t *ctx, dispatch_task_t *task, dispatch_time_t deadline) {
   dispatch_assert(task);
   dispatch_assert(task->waitable);
 
   dispatch_printf("dispatch_queue_task_wait: %u   task=%u\n", (size_t)ctx,
                   (size_t)task);
 
-  if (task->waitable) {
-    // wait on the task's event counter to signal that it is complete
-    event_counter_t *counter = (event_counter_t *)task->private_data;
+  // wait on the task's event counter to signal that it is complete
+  event_counter_t *counter = (event_counter_t *)task->private_data;
 
-    event_counter_wait(counter);
-    // the contract is that the dispatch queue must delete waitable tasks
-    event_counter_delete(counter);
-    dispatch_task_delete(task);
-  }
+  if (!event_counter_wait_until(counter, deadline)) return DISPATCH_WAIT_TIMEOUT;
+  // the contract is that the dispatch queue must delete waitable tasks
+  event_counter_delete(counter);
+  dispatch_task_delete(task);
+
+  return DISPATCH_WAIT_SUCCESS;
 }
 
-void dispatch_queue_group_wait(dispatch_queue_t *ctx, dispatch_group_t *group) {
-  dispatch_assert(group);
-  dispatch_assert(group->waitable);
+void dispatch_wait_any(dispatch_task_t **tasks, size_t count, size_t *index) {
+  dispatch_assert(tasks);
+  dispatch_assert(index);
 
-  dispatch_printf("dispatch_queue_group_wait: %u   group=%u\n", (size_t)ctx,
-                  (size_t)group);
+  dispatch_printf("dispatch_wait_any: %u   count=%u\n", (size_t)tasks, count);
 
-  if (group->waitable) {
-    event_counter_t *counter = (event_counter_t *)group->tasks[0]->private_data;
-    event_counter_wait(counter);
-    // the contract is that the dispatch queue must delete waitable tasks
-    event_counter_delete(counter);
-    for (int i = 0; i < group->count; i++) {
-      dispatch_task_delete(group->tasks[i]);
+  // NOTE: the bare-metal event counters are polled, like dispatch_queue_wait
+  for (;;) {
+    for (size_t i = 0; i < count; i++) {
+      if (tasks[i] == NULL) continue;
+      if (dispatch_queue_task_poll(NULL, tasks[i])) {
+        tasks[i] = NULL;
+        *index = i;
+        return;
+      }
     }
   }
 }
 
+void dispatch_wait_all(dispatch_task_t **tasks, size_t count) {
+  dispatch_assert(tasks);
+
+  dispatch_printf("dispatch_wait_all: %u   count=%u\n", (size_t)tasks, count);
+
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == NULL) continue;
+    dispatch_queue_task_wait(NULL, tasks[i]);
+    tasks[i] = NULL;
+  }
+}
+
+void completion_ring_notify(dispatch_completion_t *completion) {
+  // NOTE: the bare-metal consumer polls, so there is nothing to wake
+}
+
+size_t dispatch_completion_wait(dispatch_completion_t *completion,
+                                void **arguments, size_t count) {
+  dispatch_assert(completion);
+  dispatch_assert(count > 0);
+
+  dispatch_printf("dispatch_completion_wait: %u\n", (size_t)completion);
+
+  size_t reaped;
+
+  // NOTE: the bare-metal completion queue is polled, like dispatch_queue_wait
+  while ((reaped = dispatch_completion_poll(completion, arguments, count)) == 0)
+    continue;
+
+  return reaped;
+}
+
 void dispatch_queue_wait(dispatch_queue_t *ctx) {
+  dispatch_queue_wait_until(ctx, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_wait_until(dispatch_queue_t *ctx,
+                                                 dispatch_time_t deadline) {
   dispatch_xcore_queue_t *dispatch_queue = (dispatch_xcore_queue_t *)ctx;
   dispatch_assert(dispatch_queue);
 
@@ -275,7 +560,14 @@ void dispatch_queue_wait(dispatch_queue_t *ctx) {
   for (;;) {
     busy_count = busy_workers(dispatch_queue);
     waiting_count = queue_size(dispatch_queue->queue);
-    if ((busy_count + waiting_count) == 0) return;
+    // broadcasts that have not been taken are waiting too
+    for (int i = 0; i < dispatch_queue->thread_count; i++) {
+      if (__atomic_load_n(&dispatch_queue->worker_data[i].broadcast,
+                          __ATOMIC_SEQ_CST))
+        waiting_count++;
+    }
+    if ((busy_count + waiting_count) == 0) return DISPATCH_WAIT_SUCCESS;
+    if (deadline_passed(deadline)) return DISPATCH_WAIT_TIMEOUT;
   }
 }
 
@@ -291,13 +583,11 @@ void dispatch_queue_delete(dispatch_queue_t *ctx) {
 
   dispatch_printf("dispatch_queue_delete: %u\n", (size_t)dispatch_queue);
 
-  queue_delete(dispatch_queue->queue, dispatch_queue->cend);
+  queue_deinit(dispatch_queue->queue, dispatch_queue->cend);
 
   chanend_free(dispatch_queue->cend);
 
-  // free memory
-  dispatch_free((void *)dispatch_queue->thread_stack);
-  dispatch_free((void *)dispatch_queue->worker_data);
-  dispatch_free((void *)dispatch_queue->thread_status);
-  dispatch_free((void *)dispatch_queue);
+  // free memory, caller storage is owned by the caller
+  if (dispatch_queue->owns_storage)
+    allocator_free(dispatch_queue->allocator, (void *)dispatch_queue);
 }
@@ -7,6 +7,8 @@
 #include <string.h>
 
 #include "FreeRTOS.h"
+#include "allocator.h"
+#include "completion_ring.h"
 #include "dispatch_config.h"
 #include "dispatch_group.h"
 #include "dispatch_queue.h"
@@ -15,8 +17,17 @@
 #include "event_counter.h"
 #include "event_groups.h"
 #include "queue.h"
+#include "scratch_arena.h"
 #include "task.h"
 
+// thread local storage pointer that holds the worker's data
+#ifndef DISPATCH_WORKER_CONTEXT_INDEX
+#define DISPATCH_WORKER_CONTEXT_INDEX (0)
+#endif
+
+// alignment of each structure placed in the queue's storage
+#define DISPATCH_STORAGE_ALIGNMENT (2 * sizeof(void *))
+
 //***********************
 //***********************
 //***********************
@@ -24,14 +35,55 @@
 //***********************
 //***********************
 //***********************
+// states of a worker's waiting flag
+#define WORKER_RUNNING (0)    // the worker is not receiving from the queue
+#define WORKER_RECEIVING (1)  // the worker may be blocked on the queue
+#define WORKER_WAKING (2)     // a broadcaster is aborting the receive
+
 typedef struct dispatch_worker_data_struct dispatch_worker_data_t;
 struct dispatch_worker_data_struct {
   size_t parent;
   QueueHandle_t xQueue;
   EventGroupHandle_t xEventGroup;
   EventBits_t xReadyBit;
+  dispatch_task_t *broadcast;  // performed before the queue's tasks
+  size_t waiting;              // WORKER_RECEIVING while the worker may be
+                               // blocked on the queue
+  dispatch_worker_start_t start_hook;
+  dispatch_worker_stop_t stop_hook;
+  void *hook_argument;
+  TaskHandle_t xDeleter;    // notified when the worker has stopped
+  void *context;            // returned by the start hook
+  scratch_arena_t scratch;  // reset after each task
+  dispatch_task_t *task;    // the task being performed, NULL if none
 };
 
+static void run_task(dispatch_task_t *task) {
+  // NOTE: read before performing the task, a graph's tasks may not outlive
+  //       their function
+  bool waitable = task->waitable;
+  bool persistent = task->persistent;
+  dispatch_group_t *group = task->group;
+
+  // cancelled tasks are skipped but still signal
+  if (!dispatch_task_is_cancelled(task)) dispatch_task_perform(task);
+
+  if (waitable) {
+    // signal the event counter, a group's tasks are deleted by its wait
+    if (!group) event_counter_signal((event_counter_t *)task->private_data);
+  } else if (persistent) {
+    // the task belongs to a graph or a reusable group, which deletes it
+  } else if (task->completion) {
+    // hand the task to the completion queue's consumer
+    completion_ring_push(task->completion, task);
+  } else {
+    // the contract is that the worker must delete non-waitable tasks
+    dispatch_task_delete(task);
+  }
+  // NOTE: the group may be deleted as soon as the task leaves it
+  if (group) dispatch_group_leave(group);
+}
+
 void dispatch_queue_worker(void *param) {
   dispatch_worker_data_t *worker_data = (dispatch_worker_data_t *)param;
 
@@ -44,24 +96,67 @@ void dispatch_queue_worker(void *param) {
   dispatch_printf("dispatch_queue_worker started: parent=%u\n",
                   worker_data->parent);
 
+  worker_data->context = NULL;
+  worker_data->task = NULL;
+  if (worker_data->start_hook)
+    worker_data->context = worker_data->start_hook(worker_data->hook_argument);
+  vTaskSetThreadLocalStoragePointer(NULL, DISPATCH_WORKER_CONTEXT_INDEX,
+                                    worker_data);
+
   for (;;) {
-    if (xQueueReceive(xQueue, &task, portMAX_DELAY)) {
-      // unset ready bit
-      xEventGroupClearBits(xEventGroup, xReadyBit);
-      // run task
-      dispatch_task_perform(task);
-      if (task->waitable) {
-        // signal the event counter
-        event_counter_signal((event_counter_t *)task->private_data);
-        // clear semaphore
+    bool stopping = false;
+
+    // NOTE: the waiting flag is set before the broadcast is checked, so a
+    //       broadcaster either sees the flag and aborts the receive, or the
+    //       broadcast is seen here
+    __atomic_store_n(&worker_data->waiting, WORKER_RECEIVING,
+                     __ATOMIC_SEQ_CST);
+    task = __atomic_exchange_n(&worker_data->broadcast, NULL, __ATOMIC_SEQ_CST);
+    if (task == NULL) {
+      if (xQueueReceive(xQueue, &task, portMAX_DELAY)) {
+        // a NULL task is sent by dispatch_queue_delete to stop the worker
+        if (task == NULL) stopping = true;
       } else {
-        // the contract is that the worker must delete non-waitable tasks
-        dispatch_task_delete(task);
+        // the receive was aborted for a broadcast
+        task = NULL;
       }
+    }
+
+    // NOTE: a broadcaster only aborts the worker while it holds the flag,
+    //       so the worker waits for an abort in progress to finish before
+    //       it leaves the receive.  Otherwise the abort could end a delay
+    //       or wait in the task's function or the stop hook.
+    size_t expected = WORKER_RECEIVING;
+    while (!__atomic_compare_exchange_n(&worker_data->waiting, &expected,
+                                        WORKER_RUNNING, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      expected = WORKER_RECEIVING;
+      vTaskDelay(1);
+    }
+    if (stopping) break;
+
+    if (task) {
+      // unset ready bit
+      xEventGroupClearBits(xEventGroup, xReadyBit);
+      worker_data->task = task;
+      run_task(task);
+      worker_data->task = NULL;
+      scratch_arena_reset(&worker_data->scratch);
       // set ready bit
       xEventGroupSetBits(xEventGroup, xReadyBit);
     }
   }
+
+  dispatch_printf("dispatch_queue_worker stopping: parent=%u\n",
+                  worker_data->parent);
+
+  // NOTE: the worker data is freed once the deleter is notified
+  TaskHandle_t xDeleter = worker_data->xDeleter;
+  if (worker_data->stop_hook)
+    worker_data->stop_hook(worker_data->hook_argument, worker_data->context);
+  xTaskNotifyGive(xDeleter);
+  // the deleter deletes the worker once it is suspended
+  vTaskSuspend(NULL);
 }
 
 //***********************
@@ -76,13 +171,90 @@ typedef struct dispatch_freertos_struct dispatch_freertos_queue_t;
 struct dispatch_freertos_struct {
   size_t thread_count;
   size_t thread_stack_size;
+  size_t thread_priority;
+  size_t started_count;  // number of workers started
+  size_t scratch_size;   // size of each worker's scratch arena
+  dispatch_worker_start_t start_hook;
+  dispatch_worker_stop_t stop_hook;
+  void *hook_argument;
   QueueHandle_t xQueue;
   EventGroupHandle_t xEventGroup;
   EventBits_t xReadyBits;
   dispatch_worker_data_t *worker_data;
   TaskHandle_t *threads;
+  char *scratch_storage;       // NULL unless the arenas are in caller storage
+  StaticTask_t *task_buffers;  // NULL unless the worker tasks are static
+  StackType_t *task_stacks;    // stacks of the static worker tasks
+  bool caller_storage;         // placed in storage provided by the caller
+  const dispatch_allocator_t *allocator;  // allocates the queue's memory
 };
 
+// Rounds the size up so the next structure in the storage is aligned
+static size_t storage_align(size_t size) {
+  return (size + DISPATCH_STORAGE_ALIGNMENT - 1) &
+         ~(DISPATCH_STORAGE_ALIGNMENT - 1);
+}
+
+static void worker_start(dispatch_freertos_queue_t *dispatch_queue, int i) {
+  dispatch_printf("worker_start: %u   worker=%d\n", (size_t)dispatch_queue, i);
+
+  if (dispatch_queue->scratch_storage == NULL)
+    scratch_arena_init(&dispatch_queue->worker_data[i].scratch,
+                       dispatch_queue->scratch_size, dispatch_queue->allocator);
+
+#if configSUPPORT_STATIC_ALLOCATION
+  if (dispatch_queue->task_buffers) {
+    dispatch_queue->threads[i] = xTaskCreateStatic(
+        dispatch_queue_worker, "", dispatch_queue->thread_stack_size,
+        (void *)&dispatch_queue->worker_data[i],
+        dispatch_queue->thread_priority,
+        &dispatch_queue->task_stacks[dispatch_queue->thread_stack_size * i],
+        &dispatch_queue->task_buffers[i]);
+    return;
+  }
+#endif
+
+  xTaskCreate(dispatch_queue_worker, "", dispatch_queue->thread_stack_size,
+              (void *)&dispatch_queue->worker_data[i],
+              dispatch_queue->thread_priority, &dispatch_queue->threads[i]);
+}
+
+static int ready_workers(dispatch_freertos_queue_t *dispatch_queue) {
+  EventBits_t xStartedBits;
+  EventBits_t xReadyBits;
+  int ready_count = 0;
+
+  xStartedBits = 0xFFFFFFFF >> (32 - dispatch_queue->started_count);
+  xReadyBits = xEventGroupGetBits(dispatch_queue->xEventGroup) & xStartedBits;
+  while (xReadyBits) {
+    xReadyBits &= (xReadyBits - 1);
+    ready_count++;
+  }
+
+  return ready_count;
+}
+
+static void worker_start_on_demand(dispatch_freertos_queue_t *dispatch_queue) {
+  int i = -1;
+  bool start;
+
+  // start another worker if there is more work waiting than ready workers
+  start = (dispatch_queue->started_count == 0) ||
+          (uxQueueMessagesWaiting(dispatch_queue->xQueue) >
+           ready_workers(dispatch_queue));
+  if (!start) return;
+
+  // claim the next worker
+  taskENTER_CRITICAL();
+  if (dispatch_queue->started_count < dispatch_queue->thread_count) {
+    i = dispatch_queue->started_count++;
+  }
+  taskEXIT_CRITICAL();
+
+  // create the task outside of the critical section
+  if (i >= 0) worker_start(dispatch_queue, i);
+}
+
 //***********************
 //***********************
 //***********************
@@ -94,30 +266,156 @@ struct dispatch_freertos_struct {
 dispatch_queue_t *dispatch_queue_create(size_t length, size_t thread_count,
                                         size_t thread_stack_size,
                                         size_t thread_priority) {
+  dispatch_queue_attr_t attr;
+
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = thread_stack_size;
+  attr.thread_priority = thread_priority;
+
+  return dispatch_queue_create_with_attr(length, thread_count, &attr);
+}
+
+dispatch_queue_t *dispatch_queue_create_with_attr(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr) {
   dispatch_freertos_queue_t *dispatch_queue;
+  dispatch_assert(attr);
 
   dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
                   thread_count);
 
-  dispatch_queue = pvPortMalloc(sizeof(dispatch_freertos_queue_t));
+  const dispatch_allocator_t *allocator = allocator_resolve(attr->allocator);
+  dispatch_queue =
+      allocator_malloc(allocator, sizeof(dispatch_freertos_queue_t));
 
+  dispatch_queue->allocator = allocator;
   dispatch_queue->thread_count = thread_count;
-  dispatch_queue->thread_stack_size = thread_stack_size;
+  dispatch_queue->thread_stack_size = attr->thread_stack_size;
+
+  // NOTE: the CPU set, placement and scheduling policy are not supported
+  dispatch_queue->start_hook = attr->worker_start;
+  dispatch_queue->stop_hook = attr->worker_stop;
+  dispatch_queue->hook_argument = attr->worker_argument;
+  dispatch_queue->scratch_size = attr->scratch_size;
 
   // allocate FreeRTOS queue
   dispatch_queue->xQueue = xQueueCreate(length, sizeof(dispatch_task_t *));
 
   // allocate threads
-  dispatch_queue->threads = pvPortMalloc(sizeof(TaskHandle_t) * thread_count);
+  dispatch_queue->threads =
+      allocator_malloc(allocator, sizeof(TaskHandle_t) * thread_count);
 
   // allocate thread data
-  dispatch_queue->worker_data =
-      pvPortMalloc(sizeof(dispatch_worker_data_t) * thread_count);
+  dispatch_queue->worker_data = allocator_malloc(
+      allocator, sizeof(dispatch_worker_data_t) * thread_count);
 
   dispatch_queue->xEventGroup = xEventGroupCreate();
 
+  dispatch_queue->scratch_storage = NULL;
+  dispatch_queue->task_buffers = NULL;
+  dispatch_queue->task_stacks = NULL;
+  dispatch_queue->caller_storage = false;
+
+  // initialize the queue
+  dispatch_queue_init(dispatch_queue, attr->thread_priority);
+
+  dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
+
+  return dispatch_queue;
+}
+
+// Returns the offset of the next structure placed in the storage
+static size_t storage_place(size_t *offset, size_t size) {
+  size_t place = storage_align(*offset);
+  *offset = place + size;
+  return place;
+}
+
+// Places the queue's structures in the storage, or only measures the
+// storage if it is NULL.  Returns the size of the storage.
+static size_t storage_layout(char *storage, size_t length, size_t thread_count,
+                             const dispatch_queue_attr_t *attr) {
+  dispatch_freertos_queue_t *dispatch_queue =
+      (dispatch_freertos_queue_t *)storage;
+  size_t offset = sizeof(dispatch_freertos_queue_t);
+  size_t threads = storage_place(&offset, sizeof(TaskHandle_t) * thread_count);
+  size_t worker_data =
+      storage_place(&offset, sizeof(dispatch_worker_data_t) * thread_count);
+  // each arena is padded so the next one is aligned
+  size_t scratch = storage_place(
+      &offset, storage_align(attr->scratch_size) * thread_count);
+#if configSUPPORT_STATIC_ALLOCATION
+  size_t queue_buffer = storage_place(&offset, sizeof(StaticQueue_t));
+  size_t queue_storage =
+      storage_place(&offset, sizeof(dispatch_task_t *) * length);
+  size_t event_group_buffer =
+      storage_place(&offset, sizeof(StaticEventGroup_t));
+  size_t task_buffers =
+      storage_place(&offset, sizeof(StaticTask_t) * thread_count);
+  size_t task_stacks = storage_place(
+      &offset, sizeof(StackType_t) * attr->thread_stack_size * thread_count);
+#endif
+
+  if (storage) {
+    dispatch_queue->threads = (TaskHandle_t *)&storage[threads];
+    dispatch_queue->worker_data =
+        (dispatch_worker_data_t *)&storage[worker_data];
+    dispatch_queue->scratch_storage = &storage[scratch];
+#if configSUPPORT_STATIC_ALLOCATION
+    dispatch_queue->xQueue = xQueueCreateStatic(
+        length, sizeof(dispatch_task_t *), (uint8_t *)&storage[queue_storage],
+        (StaticQueue_t *)&storage[queue_buffer]);
+    dispatch_queue->xEventGroup = xEventGroupCreateStatic(
+        (StaticEventGroup_t *)&storage[event_group_buffer]);
+    dispatch_queue->task_buffers = (StaticTask_t *)&storage[task_buffers];
+    dispatch_queue->task_stacks = (StackType_t *)&storage[task_stacks];
+#else
+    // NOTE: without static allocation, the FreeRTOS objects are allocated
+    //       here and the worker tasks when they are started
+    dispatch_queue->xQueue = xQueueCreate(length, sizeof(dispatch_task_t *));
+    dispatch_queue->xEventGroup = xEventGroupCreate();
+    dispatch_queue->task_buffers = NULL;
+    dispatch_queue->task_stacks = NULL;
+#endif
+  }
+
+  return offset;
+}
+
+size_t dispatch_queue_storage_size(size_t length, size_t thread_count,
+                                   const dispatch_queue_attr_t *attr) {
+  dispatch_assert(attr);
+
+  return storage_layout(NULL, length, thread_count, attr);
+}
+
+dispatch_queue_t *dispatch_queue_create_with_storage(
+    size_t length, size_t thread_count, const dispatch_queue_attr_t *attr,
+    void *storage) {
+  dispatch_freertos_queue_t *dispatch_queue =
+      (dispatch_freertos_queue_t *)storage;
+  dispatch_assert(attr);
+  dispatch_assert(storage);
+  dispatch_assert(((size_t)storage % DISPATCH_STORAGE_ALIGNMENT) == 0);
+
+  dispatch_printf("dispatch_queue_create: length=%d, thread_count=%d\n", length,
+                  thread_count);
+
+  // place the FreeRTOS queue, threads, thread data and scratch arenas
+  storage_layout((char *)storage, length, thread_count, attr);
+
+  dispatch_queue->thread_count = thread_count;
+  dispatch_queue->thread_stack_size = attr->thread_stack_size;
+
+  // NOTE: the CPU set, placement and scheduling policy are not supported
+  dispatch_queue->start_hook = attr->worker_start;
+  dispatch_queue->stop_hook = attr->worker_stop;
+  dispatch_queue->hook_argument = attr->worker_argument;
+  dispatch_queue->scratch_size = attr->scratch_size;
+  dispatch_queue->caller_storage = true;
+  dispatch_queue->allocator = allocator_resolve(attr->allocator);
+
   // initialize the queue
-  dispatch_queue_init(dispatch_queue, thread_priority);
+  dispatch_queue_init(dispatch_queue, attr->thread_priority);
 
   dispatch_printf("dispatch_queue_create: %u\n", (size_t)dispatch_queue);
 
@@ -130,23 +428,174 @@ void dispatch_queue_init(dispatch_queue_t *ctx, size_t thread_priority) {
 
   dispatch_printf("dispatch_queue_init: %u\n", (size_t)dispatch_queue);
 
-  // create workers
+  dispatch_queue->thread_priority = thread_priority;
+  dispatch_queue->started_count = 0;
+
+  // initialize workers, the worker tasks are created on demand
   for (int i = 0; i < dispatch_queue->thread_count; i++) {
     dispatch_queue->worker_data[i].parent = (size_t)dispatch_queue;
     dispatch_queue->worker_data[i].xQueue = dispatch_queue->xQueue;
     dispatch_queue->worker_data[i].xEventGroup = dispatch_queue->xEventGroup;
     dispatch_queue->worker_data[i].xReadyBit = 1 << i;
-    // create task
-    xTaskCreate(dispatch_queue_worker, "", dispatch_queue->thread_stack_size,
-                (void *)&dispatch_queue->worker_data[i], thread_priority,
-                &dispatch_queue->threads[i]);
+    dispatch_queue->worker_data[i].broadcast = NULL;
+    dispatch_queue->worker_data[i].waiting = WORKER_RUNNING;
+    dispatch_queue->worker_data[i].start_hook = dispatch_queue->start_hook;
+    dispatch_queue->worker_data[i].stop_hook = dispatch_queue->stop_hook;
+    dispatch_queue->worker_data[i].hook_argument =
+        dispatch_queue->hook_argument;
+    dispatch_queue->worker_data[i].xDeleter = NULL;
+    dispatch_queue->worker_data[i].context = NULL;
+    if (dispatch_queue->scratch_storage) {
+      size_t stride = storage_align(dispatch_queue->scratch_size);
+      scratch_arena_place(&dispatch_queue->worker_data[i].scratch,
+                          &dispatch_queue->scratch_storage[stride * i],
+                          dispatch_queue->scratch_size);
+    } else {
+      // the arenas are allocated when the workers start
+      scratch_arena_init(&dispatch_queue->worker_data[i].scratch, 0, NULL);
+    }
   }
-  // set the ready bits
+  // set the ready bits, workers that have not been started are always ready
   dispatch_queue->xReadyBits =
       0xFFFFFFFF >> (32 - dispatch_queue->thread_count);
   xEventGroupSetBits(dispatch_queue->xEventGroup, dispatch_queue->xReadyBits);
 }
 
+void dispatch_queue_prewarm(dispatch_queue_t *ctx) {
+  dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_prewarm: %u\n", (size_t)dispatch_queue);
+
+  for (;;) {
+    int i = -1;
+
+    taskENTER_CRITICAL();
+    if (dispatch_queue->started_count < dispatch_queue->thread_count)
+      i = dispatch_queue->started_count++;
+    taskEXIT_CRITICAL();
+
+    if (i < 0) break;
+    worker_start(dispatch_queue, i);
+  }
+}
+
+dispatch_task_t *dispatch_queue_broadcast(dispatch_queue_t *ctx,
+                                          dispatch_function_t function,
+                                          void *argument) {
+  dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+  dispatch_assert(function);
+
+  dispatch_printf("dispatch_queue_broadcast: %u\n", (size_t)dispatch_queue);
+
+  // every worker performs the broadcast, so they must all be started
+  dispatch_queue_prewarm(ctx);
+
+  dispatch_task_t *task = allocator_task_create(dispatch_queue->allocator,
+                                                function, argument, true);
+  task->private_data = event_counter_create(dispatch_queue->thread_count,
+                                            dispatch_queue->allocator);
+
+  for (int i = 0; i < dispatch_queue->thread_count; i++) {
+    dispatch_worker_data_t *worker_data = &dispatch_queue->worker_data[i];
+    dispatch_task_t *expected = NULL;
+
+    // wait for the worker to take its previous broadcast
+    while (!__atomic_compare_exchange_n(&worker_data->broadcast, &expected,
+                                        task, false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST)) {
+      expected = NULL;
+      vTaskDelay(1);
+    }
+
+    // NOTE: FreeRTOS can not wait on a queue and a notification at once, so
+    //       a worker that is blocked on the queue has its receive aborted.
+    //       The waiting flag is claimed first, which holds the worker in its
+    //       receive, so the abort can not reach a task's function.  The
+    //       abort fails if the worker has not blocked yet, so it is retried
+    //       until the worker takes the broadcast or stops waiting.
+    while (__atomic_load_n(&worker_data->broadcast, __ATOMIC_SEQ_CST)) {
+      size_t expected = WORKER_RECEIVING;
+      if (__atomic_compare_exchange_n(&worker_data->waiting, &expected,
+                                      WORKER_WAKING, false, __ATOMIC_SEQ_CST,
+                                      __ATOMIC_SEQ_CST)) {
+        BaseType_t aborted = xTaskAbortDelay(dispatch_queue->threads[i]);
+        __atomic_store_n(&worker_data->waiting, WORKER_RECEIVING,
+                         __ATOMIC_SEQ_CST);
+        // the worker takes the broadcast once its receive returns
+        if (aborted == pdPASS) break;
+      } else if (expected == WORKER_RUNNING) {
+        // the worker takes the broadcast before it next receives
+        break;
+      }
+      vTaskDelay(1);
+    }
+  }
+
+  return task;
+}
+
+void dispatch_worker_blocking_begin() {
+  // NOTE: the FreeRTOS workers are not compensated for blocking
+}
+
+void dispatch_worker_blocking_end() {}
+
+// Returns the calling worker's data
+static dispatch_worker_data_t *worker_current() {
+  return (dispatch_worker_data_t *)pvTaskGetThreadLocalStoragePointer(
+      NULL, DISPATCH_WORKER_CONTEXT_INDEX);
+}
+
+void *dispatch_worker_context() {
+  dispatch_worker_data_t *worker_data = worker_current();
+
+  return worker_data ? worker_data->context : NULL;
+}
+
+dispatch_task_t *dispatch_task_current() {
+  dispatch_worker_data_t *worker_data = worker_current();
+
+  return worker_data ? worker_data->task : NULL;
+}
+
+scratch_arena_t *scratch_arena_current() {
+  dispatch_worker_data_t *worker_data = worker_current();
+
+  return worker_data ? &worker_data->scratch : NULL;
+}
+
+size_t dispatch_queue_scratch_high_watermark(dispatch_queue_t *ctx) {
+  dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+
+  dispatch_printf("dispatch_queue_scratch_high_watermark: %u\n",
+                  (size_t)dispatch_queue);
+
+  size_t high_watermark = 0;
+  for (int i = 0; i < dispatch_queue->started_count; i++) {
+    size_t worker_high_watermark =
+        scratch_arena_high_watermark(&dispatch_queue->worker_data[i].scratch);
+    if (worker_high_watermark > high_watermark)
+      high_watermark = worker_high_watermark;
+  }
+
+  return high_watermark;
+}
+
+dispatch_task_t *dispatch_queue_task_create(dispatch_queue_t *ctx,
+                                            dispatch_function_t function,
+                                            void *argument, bool waitable) {
+  dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
+  dispatch_assert(dispatch_queue);
+
+  // NOTE: the task table is not supported, the queue holds 32-bit task
+  //       pointers already
+  return allocator_task_create(dispatch_queue->allocator, function, argument,
+                               waitable);
+}
+
 void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
   dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
   dispatch_assert(dispatch_queue);
@@ -156,11 +605,12 @@ void dispatch_queue_task_add(dispatch_queue_t *ctx, dispatch_task_t *task) {
                   (size_t)dispatch_queue, (size_t)task);
 
   if (task->waitable) {
-    task->private_data = event_counter_create(1);
+    task->private_data = event_counter_create(1, dispatch_queue->allocator);
   }
 
   // send to queue
   xQueueSend(dispatch_queue->xQueue, (void *)&task, portMAX_DELAY);
+  worker_start_on_demand(dispatch_queue);
 }
 
 void dispatch_queue_group_add(dispatch_queue_t *ctx, dispatch_group_t *group) {
@@ -171,69 +621,153 @@ void dispatch_queue_group_add(dispatch_queue_t *ctx, dispatch_group_t *group) {
   dispatch_printf("dispatch_queue_group_add: %u   group=%u\n",
                   (size_t)dispatch_queue, (size_t)group);
 
-  event_counter_t *counter = NULL;
-
   if (group->waitable) {
-    // create event counter
-    counter = event_counter_create(group->count);
+    // the tasks leave the group as they finish
+    __atomic_add_fetch(&group->pending, group->count, __ATOMIC_RELAXED);
   }
 
   // send to queue
   for (int i = 0; i < group->count; i++) {
-    group->tasks[i]->private_data = counter;
-    xQueueSend(dispatch_queue->xQueue, (void *)&group->tasks[i], portMAX_DELAY);
+    dispatch_task_t *task = group_task(group, i);
+    xQueueSend(dispatch_queue->xQueue, (void *)&task, portMAX_DELAY);
+    worker_start_on_demand(dispatch_queue);
   }
 }
 
+dispatch_time_t dispatch_time_now() {
+  TimeOut_t xTimeOut;
+
+  // the timeout state extends the tick count with its overflow count
+  vTaskSetTimeOutState(&xTimeOut);
+  uint64_t ticks = ((uint64_t)xTimeOut.xOverflowCount << 32) |
+                   (uint32_t)xTimeOut.xTimeOnEntering;
+
+  return (ticks * 1000000) / configTICK_RATE_HZ;
+}
+
+// Returns the number of ticks until the deadline
+static TickType_t deadline_ticks(dispatch_time_t deadline) {
+  if (deadline == DISPATCH_TIME_FOREVER) return portMAX_DELAY;
+
+  dispatch_time_t now = dispatch_time_now();
+  dispatch_time_t timeout = (deadline > now) ? (deadline - now) : 0;
+  // round up so the wait does not end before the deadline
+  uint64_t ticks = (timeout * configTICK_RATE_HZ + 999999) / 1000000;
+
+  return (ticks < portMAX_DELAY) ? ticks : (portMAX_DELAY - 1);
+}
+
 void dispatch_queue_task_wait(dispatch_queue_t *ctx, dispatch_task_t *task) {
+  dispatch_queue_task_wait_until(ctx, task, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_task_wait_until(
+    dispatch_queue_t *ctx, dispatch_task_t *task, dispatch_time_t deadline) {
   dispatch_assert(task);
   dispatch_assert(task->waitable);
 
   dispatch_printf("dispatch_queue_task_wait: %u   task=%u\n", (size_t)ctx,
                   (size_t)task);
 
-  if (task->waitable) {
-    event_counter_t *counter = (event_counter_t *)task->private_data;
-    event_counter_wait(counter);
-    // the contract is that the dispatch queue must delete waitable tasks
-    event_counter_delete(counter);
-    dispatch_task_delete(task);
-  }
+  event_counter_t *counter = (event_counter_t *)task->private_data;
+
+  if (!event_counter_wait_until(counter, deadline)) return DISPATCH_WAIT_TIMEOUT;
+  // the contract is that the dispatch queue must delete waitable tasks
+  event_counter_delete(counter);
+  dispatch_task_delete(task);
+
+  return DISPATCH_WAIT_SUCCESS;
 }
 
-void dispatch_queue_group_wait(dispatch_queue_t *ctx, dispatch_group_t *group) {
-  dispatch_assert(group);
-  dispatch_assert(group->waitable);
+void dispatch_wait_any(dispatch_task_t **tasks, size_t count, size_t *index) {
+  dispatch_assert(tasks);
+  dispatch_assert(index);
 
-  dispatch_printf("dispatch_queue_group_wait: %u   group=%u\n", (size_t)ctx,
-                  (size_t)group);
+  dispatch_printf("dispatch_wait_any: %u   count=%u\n", (size_t)tasks, count);
 
-  if (group->waitable) {
-    event_counter_t *counter = (event_counter_t *)group->tasks[0]->private_data;
-    event_counter_wait(counter);
-    event_counter_delete(counter);
-    for (int i = 0; i < group->count; i++) {
-      dispatch_task_delete(group->tasks[i]);
+  // NOTE: the FreeRTOS event counters are polled, a tick apart
+  for (;;) {
+    for (size_t i = 0; i < count; i++) {
+      if (tasks[i] == NULL) continue;
+      if (dispatch_queue_task_poll(NULL, tasks[i])) {
+        tasks[i] = NULL;
+        *index = i;
+        return;
+      }
     }
+    // let other tasks run before polling again
+    vTaskDelay(1);
+  }
+}
+
+void dispatch_wait_all(dispatch_task_t **tasks, size_t count) {
+  dispatch_assert(tasks);
+
+  dispatch_printf("dispatch_wait_all: %u   count=%u\n", (size_t)tasks, count);
+
+  for (size_t i = 0; i < count; i++) {
+    if (tasks[i] == NULL) continue;
+    dispatch_queue_task_wait(NULL, tasks[i]);
+    tasks[i] = NULL;
+  }
+}
+
+void completion_ring_notify(dispatch_completion_t *completion) {
+  // NOTE: the FreeRTOS consumer polls, so there is nothing to wake
+}
+
+size_t dispatch_completion_wait(dispatch_completion_t *completion,
+                                void **arguments, size_t count) {
+  dispatch_assert(completion);
+  dispatch_assert(count > 0);
+
+  dispatch_printf("dispatch_completion_wait: %u\n", (size_t)completion);
+
+  size_t reaped;
+
+  // NOTE: the FreeRTOS completion queue is polled, a tick apart
+  while ((reaped = dispatch_completion_poll(completion, arguments, count)) ==
+         0) {
+    vTaskDelay(1);
   }
+
+  return reaped;
 }
 
 void dispatch_queue_wait(dispatch_queue_t *ctx) {
+  dispatch_queue_wait_until(ctx, DISPATCH_TIME_FOREVER);
+}
+
+dispatch_wait_status_t dispatch_queue_wait_until(dispatch_queue_t *ctx,
+                                                 dispatch_time_t deadline) {
   dispatch_freertos_queue_t *dispatch_queue = (dispatch_freertos_queue_t *)ctx;
   dispatch_assert(dispatch_queue);
 
   dispatch_printf("dispatch_queue_wait: %u\n", (size_t)dispatch_queue);
 
   int waiting_count;
+  EventBits_t xBits;
 
   // busywait for xQueue to empty
   for (;;) {
     waiting_count = uxQueueMessagesWaiting(dispatch_queue->xQueue);
+    // broadcasts that have not been taken are waiting too
+    for (int i = 0; i < dispatch_queue->started_count; i++) {
+      if (__atomic_load_n(&dispatch_queue->worker_data[i].broadcast,
+                          __ATOMIC_SEQ_CST))
+        waiting_count++;
+    }
     if (waiting_count == 0) break;
+    if (deadline_ticks(deadline) == 0) return DISPATCH_WAIT_TIMEOUT;
   }
   // wait for all ready bits to be set
-  xEventGroupWaitBits(dispatch_queue->xEventGroup, dispatch_queue->xReadyBits,
-                      pdFALSE, pdTRUE, portMAX_DELAY);
+  xBits = xEventGroupWaitBits(dispatch_queue->xEventGroup,
+                              dispatch_queue->xReadyBits, pdFALSE, pdTRUE,
+                              deadline_ticks(deadline));
+  if ((xBits & dispatch_queue->xReadyBits) != dispatch_queue->xReadyBits)
+    return DISPATCH_WAIT_TIMEOUT;
+
+  return DISPATCH_WAIT_SUCCESS;
 }
 
 void dispatch_queue_delete(dispatch_queue_t *ctx) {
@@ -242,14 +776,44 @@ void dispatch_queue_delete(dispatch_queue_t *ctx) {
 
   dispatch_printf("dispatch_queue_delete: %u\n", (size_t)dispatch_queue);
 
-  // delete all threads
-  for (int i = 0; i < dispatch_queue->thread_count; i++) {
+  // NOTE: a static task is only removed by the scheduler once it is not
+  //       running, so static workers are stopped like workers with a hook
+  bool stopping = dispatch_queue->stop_hook || dispatch_queue->task_buffers;
+
+  if (stopping) {
+    // the workers call the stop hook in their own threads, so each one is
+    // sent a NULL task, ahead of any waiting tasks, and suspends itself
+    TaskHandle_t xDeleter = xTaskGetCurrentTaskHandle();
+    dispatch_task_t *task = NULL;
+    for (int i = 0; i < dispatch_queue->started_count; i++) {
+      dispatch_queue->worker_data[i].xDeleter = xDeleter;
+    }
+    for (int i = 0; i < dispatch_queue->started_count; i++) {
+      xQueueSendToFront(dispatch_queue->xQueue, (void *)&task, portMAX_DELAY);
+    }
+    for (int i = 0; i < dispatch_queue->started_count; i++) {
+      ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    }
+  }
+
+  // delete all started threads
+  for (int i = 0; i < dispatch_queue->started_count; i++) {
+    if (stopping) {
+      while (eTaskGetState(dispatch_queue->threads[i]) != eSuspended)
+        vTaskDelay(1);
+    }
     vTaskDelete(dispatch_queue->threads[i]);
   }
 
-  // free memory
-  vPortFree((void *)dispatch_queue->worker_data);
-  vPortFree((void *)dispatch_queue->threads);
+  // free memory, caller storage is owned by the caller
+  for (int i = 0; i < dispatch_queue->started_count; i++) {
+    scratch_arena_free(&dispatch_queue->worker_data[i].scratch);
+  }
   vEventGroupDelete(dispatch_queue->xEventGroup);
   vQueueDelete(dispatch_queue->xQueue);
+  if (!dispatch_queue->caller_storage) {
+    allocator_free(dispatch_queue->allocator, dispatch_queue->worker_data);
+    allocator_free(dispatch_queue->allocator, dispatch_queue->threads);
+    allocator_free(dispatch_queue->allocator, dispatch_queue);
+  }
 }
@@ -0,0 +1,72 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#include <stdint.h>
+
+#include "allocator.h"
+#include "dispatch_config.h"
+#include "dispatch_queue.h"
+#include "scratch_arena.h"
+
+void scratch_arena_init(scratch_arena_t *arena, size_t size,
+                        const dispatch_allocator_t *allocator) {
+  dispatch_assert(arena);
+
+  arena->allocator = allocator_resolve(allocator);
+  arena->base = size ? allocator_malloc(arena->allocator, size) : NULL;
+  arena->size = size;
+  arena->used = 0;
+  // NOTE: the high watermark may already be read by another thread
+  __atomic_store_n(&arena->high_watermark, 0, __ATOMIC_RELAXED);
+}
+
+void scratch_arena_place(scratch_arena_t *arena, void *base, size_t size) {
+  dispatch_assert(arena);
+
+  arena->base = size ? base : NULL;
+  arena->size = size;
+  arena->used = 0;
+  __atomic_store_n(&arena->high_watermark, 0, __ATOMIC_RELAXED);
+  arena->allocator = NULL;
+}
+
+void scratch_arena_free(scratch_arena_t *arena) {
+  dispatch_assert(arena);
+
+  if (arena->base && arena->allocator)
+    allocator_free(arena->allocator, arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+}
+
+void scratch_arena_reset(scratch_arena_t *arena) {
+  dispatch_assert(arena);
+
+  // NOTE: the high watermark is only written by the owning worker, it is
+  //       updated here rather than on every allocation
+  if (arena->used > arena->high_watermark)
+    __atomic_store_n(&arena->high_watermark, arena->used, __ATOMIC_RELAXED);
+  arena->used = 0;
+}
+
+size_t scratch_arena_high_watermark(const scratch_arena_t *arena) {
+  dispatch_assert(arena);
+
+  return __atomic_load_n(&arena->high_watermark, __ATOMIC_RELAXED);
+}
+
+void *dispatch_scratch_alloc(size_t size) {
+  scratch_arena_t *arena = scratch_arena_current();
+
+  if (arena == NULL || arena->base == NULL) return NULL;
+
+  // align the address, the arena's base may be aligned more loosely
+  uintptr_t start = ((uintptr_t)(arena->base + arena->used) +
+                     SCRATCH_ARENA_ALIGNMENT - 1) &
+                    ~(uintptr_t)(SCRATCH_ARENA_ALIGNMENT - 1);
+  size_t offset = start - (uintptr_t)arena->base;
+
+  if (offset > arena->size || size > arena->size - offset) return NULL;
+
+  arena->used = offset + size;
+  return arena->base + offset;
+}
@@ -2,23 +2,57 @@
 // XMOS Public License: Version 1
 #include "dispatch_task.h"
 
+#include "allocator.h"
 #include "dispatch_config.h"
 #include "dispatch_types.h"
 
 dispatch_task_t *dispatch_task_create(dispatch_function_t function,
                                       void *argument, bool waitable) {
+  return allocator_task_create(NULL, function, argument, waitable);
+}
+
+dispatch_task_t *allocator_task_create(const dispatch_allocator_t *allocator,
+                                       dispatch_function_t function,
+                                       void *argument, bool waitable) {
   dispatch_assert(function);
 
   dispatch_task_t *task;
-  task = dispatch_malloc(sizeof(dispatch_task_t));
+  allocator = allocator_resolve(allocator);
+  task = allocator_malloc(allocator, sizeof(dispatch_task_t));
 
   dispatch_task_init(task, function, argument, waitable);
+  task->allocator = allocator;
 
   dispatch_printf("dispatch_task_create:  task=%u\n", (size_t)task);
 
   return task;
 }
 
+dispatch_task_t *dispatch_task_create_with_payload(dispatch_function_t function,
+                                                   size_t size, void **payload,
+                                                   bool waitable) {
+  dispatch_assert(function);
+  dispatch_assert(payload);
+
+  // the payload follows the task, aligned like the memory malloc returns
+  const size_t alignment = 2 * sizeof(void *);
+  size_t offset = (sizeof(dispatch_task_t) + alignment - 1) & ~(alignment - 1);
+
+  dispatch_task_t *task;
+  const dispatch_allocator_t *allocator = allocator_resolve(NULL);
+  task = allocator_malloc(allocator, offset + size);
+  *payload = (char *)task + offset;
+
+  dispatch_task_init(task, function, *payload, waitable);
+  task->payload = true;
+  task->allocator = allocator;
+
+  dispatch_printf("dispatch_task_create_with_payload:  task=%u\n",
+                  (size_t)task);
+
+  return task;
+}
+
 void dispatch_task_init(dispatch_task_t *task, dispatch_function_t function,
                         void *argument, bool waitable) {
   dispatch_assert(task);
@@ -27,7 +61,36 @@ void dispatch_task_init(dispatch_task_t *task, dispatch_function_t function,
   task->function = function;
   task->argument = argument;
   task->waitable = waitable;
+  task->blocking = false;
+  task->cancelled = false;
+  task->persistent = false;
+  task->payload = false;
+  task->completion = NULL;
+  task->group = NULL;
   task->private_data = NULL;
+  task->allocator = NULL;
+}
+
+void dispatch_task_set_blocking(dispatch_task_t *task, bool blocking) {
+  dispatch_assert(task);
+
+  task->blocking = blocking;
+}
+
+void dispatch_task_cancel(dispatch_task_t *task) {
+  dispatch_assert(task);
+
+  dispatch_printf("dispatch_task_cancel:  task=%u\n", (size_t)task);
+
+  // NOTE: workers read the flag without holding a lock, relaxed ordering is
+  //       enough because a late cancel is allowed to miss
+  __atomic_store_n(&task->cancelled, true, __ATOMIC_RELAXED);
+}
+
+bool dispatch_task_is_cancelled(const dispatch_task_t *task) {
+  dispatch_assert(task);
+
+  return __atomic_load_n(&task->cancelled, __ATOMIC_RELAXED);
 }
 
 void dispatch_task_perform(dispatch_task_t *task) {
@@ -44,5 +107,5 @@ void dispatch_task_delete(dispatch_task_t *task) {
 
   dispatch_printf("dispatch_task_delete:  task=%u\n", (size_t)task);
 
-  dispatch_free(task);
+  allocator_free(task->allocator, task);
 }
@@ -6,20 +6,69 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "dispatch_allocator.h"
+#include "dispatch_completion.h"
+#include "dispatch_group.h"
 #include "dispatch_task.h"
+#include "event_counter.h"
 
 struct dispatch_task_struct {
-  dispatch_function_t function;  // the function to perform
-  void *argument;                // argument to pass to the function
-  bool waitable;                 // task can be waited on
-  void *private_data;            // private data used by queue implementations
+  dispatch_function_t function;       // the function to perform
+  void *argument;                     // argument to pass to the function
+  bool waitable;                      // task can be waited on
+  bool blocking;                      // task may block on I/O
+  bool cancelled;                     // task should be skipped by the worker
+  bool persistent;                    // task is owned by a graph or reusable
+                                      // group, the worker must not delete it
+  bool payload;                       // argument is an inline payload that
+                                      // is freed with the task
+  dispatch_completion_t *completion;  // finished task is pushed here
+  dispatch_group_t *group;            // finished task leaves this group
+  void *private_data;                 // private data used by queue
+                                      // implementations
+  const dispatch_allocator_t *allocator;  // frees the task, NULL for the
+                                          // global allocator
 };
 
+// number of chunks in a group's task array, each chunk is twice the length of
+// the one before it
+#define GROUP_CHUNK_COUNT (16)
+
 struct dispatch_group_struct {
-  size_t length;            // maximum number of tasks in the group
-  size_t count;             // number of tasks added to the group
-  bool waitable;            // group can be waited on
-  dispatch_task_t **tasks;  // array of task pointers
+  size_t length;             // length of the first chunk
+  size_t count;              // number of tasks added to the group
+  bool waitable;             // group can be waited on
+  bool reusable;             // tasks persist across submissions
+  size_t pending;            // unfinished tasks and enters, and the
+                             // GROUP_WAITING flag
+  event_counter_t *counter;  // wakes the waiter, created by the first wait
+  dispatch_task_t **chunks[GROUP_CHUNK_COUNT];  // task array, the chunks are
+                                                // allocated as it grows
+  const dispatch_allocator_t *allocator;  // allocates the group's memory
 };
 
+// set in the group's pending count while a thread is blocked waiting on it
+#define GROUP_WAITING ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+// Returns the chunk of the group's task array that holds the task at index,
+// and the task's offset in the chunk
+static inline size_t group_chunk(const dispatch_group_t *group, size_t index,
+                                 size_t *offset) {
+  // chunk k starts at length * (2^k - 1)
+  unsigned long blocks = index / group->length + 1;
+  size_t chunk = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(blocks);
+
+  *offset = index - group->length * (((size_t)1 << chunk) - 1);
+  return chunk;
+}
+
+// Returns the task at index in the group's task array
+static inline dispatch_task_t *group_task(const dispatch_group_t *group,
+                                          size_t index) {
+  size_t offset;
+  size_t chunk = group_chunk(group, index, &offset);
+
+  return group->chunks[chunk][offset];
+}
+
 #endif  // DISPATCH_TYPES_H_
\ No newline at end of file
@@ -3,9 +3,12 @@
 #ifndef DISPATCH_EVENT_COUNTER_H_
 #define DISPATCH_EVENT_COUNTER_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "dispatch_allocator.h"
 #include "dispatch_config.h"
+#include "dispatch_queue.h"
 
 typedef struct event_counter_struct event_counter_t;
 
@@ -13,9 +16,15 @@ typedef struct event_counter_struct event_counter_t;
 extern "C" {
 #endif  // __cplusplus
 
-event_counter_t *event_counter_create(size_t count);
+// Creates a counter with memory from the allocator, or from the global
+// allocator if it is NULL
+event_counter_t *event_counter_create(size_t count,
+                                      const dispatch_allocator_t *allocator);
 void event_counter_signal(event_counter_t *counter);
 void event_counter_wait(event_counter_t *counter);
+bool event_counter_wait_until(event_counter_t *counter,
+                              dispatch_time_t deadline);
+void event_counter_reset(event_counter_t *counter, size_t count);
 void event_counter_delete(event_counter_t *counter);
 
 #ifdef __cplusplus
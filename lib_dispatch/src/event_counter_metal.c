@@ -4,19 +4,27 @@
 #include "event_counter.h"
 // clang-format on
 
+#include <platform.h>
 #include <xcore/channel.h>
+#include <xcore/hwtimer.h>
 
+#include "allocator.h"
 #include "dispatch_config.h"
 
 struct event_counter_struct {
   dispatch_spinlock_t lock;
   streaming_channel_t cend;
   size_t count;
+  const dispatch_allocator_t *allocator;
 };
 
-event_counter_t *event_counter_create(size_t count) {
-  event_counter_t *counter = dispatch_malloc(sizeof(event_counter_t));
+event_counter_t *event_counter_create(size_t count,
+                                      const dispatch_allocator_t *allocator) {
+  allocator = allocator_resolve(allocator);
+  event_counter_t *counter =
+      allocator_malloc(allocator, sizeof(event_counter_t));
 
+  counter->allocator = allocator;
   counter->count = count;
   counter->lock = dispatch_spinlock_create();
   counter->cend = s_chan_alloc();
@@ -47,10 +55,47 @@ void event_counter_wait(event_counter_t *counter) {
   chanend_check_end_token(counter->cend.end_a);
 }
 
+bool event_counter_wait_until(event_counter_t *counter,
+                              dispatch_time_t deadline) {
+  dispatch_assert(counter);
+
+  if (deadline == DISPATCH_TIME_FOREVER) {
+    event_counter_wait(counter);
+    return true;
+  }
+
+  // NOTE: the deadline is converted back to reference timer ticks, which
+  //       wrap, so it is compared with a signed difference
+  uint32_t deadline_ticks = (uint32_t)(deadline * PLATFORM_REFERENCE_MHZ);
+  size_t count;
+
+  for (;;) {
+    dispatch_spinlock_get(counter->lock);
+    count = counter->count;
+    dispatch_spinlock_put(counter->lock);
+    if (count == 0) break;
+    if ((int32_t)(deadline_ticks - get_reference_time()) <= 0) return false;
+  }
+
+  // the end token is sent once the count reaches zero, consume it so the
+  // channel is empty when it is freed
+  chanend_check_end_token(counter->cend.end_a);
+  return true;
+}
+
+void event_counter_reset(event_counter_t *counter, size_t count) {
+  dispatch_assert(counter);
+
+  // NOTE: the end token of the previous count was consumed by its wait
+  dispatch_spinlock_get(counter->lock);
+  counter->count = count;
+  dispatch_spinlock_put(counter->lock);
+}
+
 void event_counter_delete(event_counter_t *counter) {
   dispatch_assert(counter);
 
   s_chan_free(counter->cend);
   dispatch_spinlock_delete(counter->lock);
-  dispatch_free(counter);
+  allocator_free(counter->allocator, counter);
 }
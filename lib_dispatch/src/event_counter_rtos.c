@@ -5,17 +5,23 @@
 // clang-format on
 
 #include "FreeRTOS.h"
+#include "allocator.h"
 #include "dispatch_config.h"
 #include "semphr.h"
 
 struct event_counter_struct {
   SemaphoreHandle_t semaphore;
   size_t count;
+  const dispatch_allocator_t *allocator;
 };
 
-event_counter_t *event_counter_create(size_t count) {
-  event_counter_t *counter = dispatch_malloc(sizeof(event_counter_t));
+event_counter_t *event_counter_create(size_t count,
+                                      const dispatch_allocator_t *allocator) {
+  allocator = allocator_resolve(allocator);
+  event_counter_t *counter =
+      allocator_malloc(allocator, sizeof(event_counter_t));
 
+  counter->allocator = allocator;
   counter->count = count;
   counter->semaphore = xSemaphoreCreateBinary();
   return counter;
@@ -45,9 +51,39 @@ void event_counter_wait(event_counter_t *counter) {
   xSemaphoreTake(counter->semaphore, portMAX_DELAY);
 }
 
+bool event_counter_wait_until(event_counter_t *counter,
+                              dispatch_time_t deadline) {
+  dispatch_assert(counter);
+
+  TickType_t ticks = portMAX_DELAY;
+
+  if (deadline != DISPATCH_TIME_FOREVER) {
+    dispatch_time_t now = dispatch_time_now();
+    dispatch_time_t timeout = (deadline > now) ? (deadline - now) : 0;
+    // round up so the wait does not end before the deadline
+    uint64_t timeout_ticks =
+        (timeout * configTICK_RATE_HZ + 999999) / 1000000;
+    ticks = (timeout_ticks < portMAX_DELAY) ? timeout_ticks
+                                            : (portMAX_DELAY - 1);
+  }
+
+  // NOTE: the semaphore is only given once, a wait that times out leaves it
+  //       for the next wait
+  return (xSemaphoreTake(counter->semaphore, ticks) == pdTRUE);
+}
+
+void event_counter_reset(event_counter_t *counter, size_t count) {
+  dispatch_assert(counter);
+
+  // NOTE: the semaphore given for the previous count was taken by its wait
+  taskENTER_CRITICAL();
+  counter->count = count;
+  taskEXIT_CRITICAL();
+}
+
 void event_counter_delete(event_counter_t *counter) {
   dispatch_assert(counter);
 
   vSemaphoreDelete(counter->semaphore);
-  dispatch_free(counter);
+  allocator_free(counter->allocator, counter);
 }
@@ -8,16 +8,29 @@ queue_t *queue_create(size_t length) {
   dispatch_assert(length > 0);
 
   queue_t *queue = dispatch_malloc(sizeof(queue_t));
-  queue->ring_buffer = dispatch_malloc(sizeof(void *) * length);
-  queue->cv = condition_variable_create();
+  queue_init(queue, dispatch_malloc(sizeof(void *) * length),
+             dispatch_malloc(sizeof(condition_variable_t)), length);
+
+  return queue;
+}
+
+void queue_init(queue_t *queue, void **ring_buffer, condition_variable_t *cv,
+                size_t length) {
+  dispatch_assert(queue);
+  dispatch_assert(ring_buffer);
+  dispatch_assert(cv);
+  dispatch_assert(length > 0);
+
+  queue->ring_buffer = ring_buffer;
+  queue->cv = cv;
+  condition_variable_init(queue->cv);
   queue->mutex = dispatch_mutex_create();
 
   queue->length = length;
   queue->head = 0;
   queue->tail = 0;
+  queue->wake_count = 0;
   queue->full = false;
-
-  return queue;
 }
 
 bool queue_full(queue_t *queue) {
@@ -30,11 +43,9 @@ bool queue_empty(queue_t *queue) {
   return (!queue->full && (queue->head == queue->tail));
 }
 
-size_t queue_size(queue_t *queue) {
-  dispatch_assert(queue);
-
-  dispatch_mutex_get(queue->mutex);
-
+// Returns the number of items in the queue
+// NOTE: the caller must hold the mutex
+static size_t queue_count(queue_t *queue) {
   size_t size = queue->length;
 
   if (!queue->full) {
@@ -45,6 +56,16 @@ size_t queue_size(queue_t *queue) {
     }
   }
 
+  return size;
+}
+
+size_t queue_size(queue_t *queue) {
+  dispatch_assert(queue);
+
+  dispatch_mutex_get(queue->mutex);
+
+  size_t size = queue_count(queue);
+
   dispatch_mutex_put(queue->mutex);
 
   return size;
@@ -85,25 +106,61 @@ bool queue_send(queue_t *queue, void *item, chanend_t cend) {
 }
 
 bool queue_receive(queue_t *queue, void **item, chanend_t cend) {
+  return queue_receive_wakeable(queue, item, NULL, cend);
+}
+
+bool queue_receive_wakeable(queue_t *queue, void **item, size_t *wake_count,
+                            chanend_t cend) {
+  size_t count = 1;
+
+  if (!queue_receive_batch(queue, item, &count, 1, wake_count, cend))
+    return false;
+
+  // no item if woken by queue_wake
+  if (count == 0) *item = NULL;
+  return true;
+}
+
+bool queue_receive_batch(queue_t *queue, void **items, size_t *count,
+                         size_t receiver_count, size_t *wake_count,
+                         chanend_t cend) {
   dispatch_assert(queue);
   dispatch_assert(queue->ring_buffer);
+  dispatch_assert(items);
+  dispatch_assert(count && *count > 0);
+  dispatch_assert(receiver_count > 0);
 
   // acquire mutex for initial predicate check
   dispatch_mutex_get(queue->mutex);
 
   while (queue_empty(queue)) {
+    if (wake_count && (*wake_count != queue->wake_count)) {
+      // woken by queue_wake, return without any items
+      *wake_count = queue->wake_count;
+      *count = 0;
+      dispatch_mutex_put(queue->mutex);
+      return true;
+    }
     // queue is empty, wait on condition variable
     if (!condition_variable_wait(queue->cv, queue->mutex, cend)) return false;
   }
 
   // NOTE: we are holding the mutex now
 
-  // set the item
-  *item = queue->ring_buffer[queue->tail];
+  // take this receiver's share of the items, at least one, so the other
+  // receivers are not left idle when the queue is shallow
+  size_t share = queue_count(queue) / receiver_count;
+  if (share == 0) share = 1;
+  if (share < *count) *count = share;
+
+  // set the items
+  for (size_t i = 0; i < *count; i++) {
+    items[i] = queue->ring_buffer[queue->tail];
+    queue->tail = (queue->tail + 1) % queue->length;
+  }
 
   // backup the ring buffer pointer
   queue->full = false;
-  queue->tail = (queue->tail + 1) % queue->length;
 
   // the queue is guaranteed to be non-full, so
   // notify any threads waiting on the condition variable
@@ -114,16 +171,33 @@ bool queue_receive(queue_t *queue, void **item, chanend_t cend) {
   return true;
 }
 
-void queue_delete(queue_t *queue, chanend_t cend) {
+void queue_wake(queue_t *queue, chanend_t cend) {
+  dispatch_assert(queue);
+
+  // wake the receivers that are waiting on an empty queue
+  dispatch_mutex_get(queue->mutex);
+  queue->wake_count++;
+  condition_variable_broadcast(queue->cv, cend);
+  dispatch_mutex_put(queue->mutex);
+}
+
+void queue_deinit(queue_t *queue, chanend_t cend) {
   dispatch_assert(queue);
   dispatch_assert(queue->ring_buffer);
 
   // notify any waiters that they can stop waiting
   condition_variable_terminate(queue->cv, cend);
-  condition_variable_delete(queue->cv);
+  condition_variable_deinit(queue->cv);
 
   dispatch_mutex_delete(queue->mutex);
+}
+
+void queue_delete(queue_t *queue, chanend_t cend) {
+  dispatch_assert(queue);
+
+  queue_deinit(queue, cend);
 
+  dispatch_free(queue->cv);
   dispatch_free(queue->ring_buffer);
   dispatch_free(queue);
 }
@@ -18,16 +18,29 @@ struct queue_struct {
   size_t head;
   size_t tail;
   size_t length;
+  size_t wake_count;  // incremented by queue_wake
   dispatch_mutex_t mutex;
   bool full;
 };
 
 queue_t *queue_create(size_t length);
+void queue_init(queue_t *queue, void **ring_buffer, condition_variable_t *cv,
+                size_t length);
 bool queue_empty(queue_t *queue);
 bool queue_full(queue_t *queue);
 size_t queue_size(queue_t *queue);
 bool queue_send(queue_t *queue, void *item, chanend_t cend);
 bool queue_receive(queue_t *queue, void **item, chanend_t cend);
+bool queue_receive_wakeable(queue_t *queue, void **item, size_t *wake_count,
+                            chanend_t cend);
+// Receives up to *count items with one acquisition of the mutex, but no more
+// than 1/receiver_count of the items waiting.  *count is set to the number of
+// items received, zero if woken by queue_wake.
+bool queue_receive_batch(queue_t *queue, void **items, size_t *count,
+                         size_t receiver_count, size_t *wake_count,
+                         chanend_t cend);
+void queue_wake(queue_t *queue, chanend_t cend);
+void queue_deinit(queue_t *queue, chanend_t cend);
 void queue_delete(queue_t *queue, chanend_t cend);
 
 #endif  // DISPATCH_QUEUE_METAL_H_
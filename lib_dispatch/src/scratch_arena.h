@@ -0,0 +1,53 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_SCRATCH_ARENA_H_
+#define DISPATCH_SCRATCH_ARENA_H_
+
+#include <stddef.h>
+
+#include "dispatch_allocator.h"
+
+// allocations are aligned like the memory that malloc returns
+#define SCRATCH_ARENA_ALIGNMENT (2 * sizeof(void *))
+
+// bump allocator owned by one worker, reset after each task
+typedef struct scratch_arena_struct scratch_arena_t;
+struct scratch_arena_struct {
+  char *base;             // NULL if the worker has no arena
+  size_t size;            // in bytes
+  size_t used;            // bytes allocated by the current task
+  size_t high_watermark;  // most bytes allocated by one task
+  const dispatch_allocator_t *allocator;  // frees base, NULL if the memory
+                                          // is the caller's
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Allocates the arena's memory from the allocator, or from the global
+// allocator if it is NULL
+void scratch_arena_init(scratch_arena_t *arena, size_t size,
+                        const dispatch_allocator_t *allocator);
+
+// Places the arena in caller memory, which scratch_arena_free leaves alone
+void scratch_arena_place(scratch_arena_t *arena, void *base, size_t size);
+
+// Frees the arena's memory, the high watermark is kept
+void scratch_arena_free(scratch_arena_t *arena);
+
+// Releases everything allocated by the task that just finished
+void scratch_arena_reset(scratch_arena_t *arena);
+
+// Returns the most bytes allocated by one task, may be called by any thread
+size_t scratch_arena_high_watermark(const scratch_arena_t *arena);
+
+// Returns the calling worker's arena, NULL if not called from a worker.
+// Implemented by each dispatch queue.
+scratch_arena_t *scratch_arena_current();
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // DISPATCH_SCRATCH_ARENA_H_
@@ -9,11 +9,13 @@ enum { SPINLOCK_NOT_ACQUIRED = 0 };
 
 spinlock_t *spinlock_create() {
   spinlock_t *lock = dispatch_malloc(sizeof(spinlock_t));
-  *lock = SPINLOCK_INITIAL_VALUE;
+  spinlock_init(lock);
 
   return lock;
 }
 
+void spinlock_init(spinlock_t *lock) { *lock = SPINLOCK_INITIAL_VALUE; }
+
 extern int spinlock_try_acquire(spinlock_t *lock);
 
 void spinlock_acquire(spinlock_t *lock) {
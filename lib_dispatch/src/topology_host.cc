@@ -0,0 +1,169 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#include "topology_host.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <tuple>
+
+#include "dispatch_config.h"
+
+#define TOPOLOGY_SYSFS_PATH "/sys/devices/system/cpu"
+
+// Parses a non-negative decimal number, returns false if text is anything else
+static bool parse_int(const std::string &text, int &value) {
+  const char *begin = text.c_str();
+  char *end;
+
+  if (text.empty() || text[0] < '0' || text[0] > '9') return false;
+  errno = 0;
+  long parsed = std::strtol(begin, &end, 10);
+  if (errno || *end != '\0' || parsed > INT_MAX) return false;
+  value = static_cast<int>(parsed);
+  return true;
+}
+
+// Parses a sysfs CPU list, for example "0-3,8-11", returns false if the list
+// is malformed
+static bool parse_cpu_list(const std::string &list, std::vector<int> &cpus) {
+  size_t pos = 0;
+
+  cpus.clear();
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    std::string range = list.substr(pos, end - pos);
+    size_t dash = range.find('-');
+    int first;
+    int last;
+    if (!parse_int(range.substr(0, dash), first)) return false;
+    if (dash == std::string::npos) {
+      last = first;
+    } else if (!parse_int(range.substr(dash + 1), last) || last < first) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    pos = end + 1;
+  }
+
+  return true;
+}
+
+static bool read_line(const std::string &path, std::string &line) {
+  std::ifstream file(path);
+  return static_cast<bool>(std::getline(file, line));
+}
+
+// Reads the CPU's core, cache and node, returns false if sysfs holds text
+// that cannot be parsed
+static bool read_cpu(topology_cpu_t &info) {
+  std::string base = TOPOLOGY_SYSFS_PATH "/cpu" + std::to_string(info.cpu);
+  std::string line;
+
+  // hardware threads that share the physical core
+  if (read_line(base + "/topology/thread_siblings_list", line)) {
+    std::vector<int> siblings;
+    if (!parse_cpu_list(line, siblings)) return false;
+    if (siblings.size()) {
+      info.core = siblings[0];
+      info.thread = std::find(siblings.begin(), siblings.end(), info.cpu) -
+                    siblings.begin();
+    }
+  }
+
+  // the highest level unified cache is the last level cache
+  int cache_level = 0;
+  for (int index = 0;; index++) {
+    std::string cache = base + "/cache/index" + std::to_string(index);
+    std::string type;
+    int level;
+    std::vector<int> shared;
+    if (!read_line(cache + "/level", line)) break;
+    if (!parse_int(line, level)) return false;
+    if (!read_line(cache + "/type", type) || type != "Unified") continue;
+    if (!read_line(cache + "/shared_cpu_list", line)) continue;
+    if (!parse_cpu_list(line, shared)) return false;
+    if (shared.size() && level > cache_level) {
+      cache_level = level;
+      info.cache_domain = shared[0];
+    }
+  }
+
+  // the NUMA node is exposed as a nodeN link in the CPU's directory
+  DIR *dir = opendir(base.c_str());
+  if (dir) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name.compare(0, 4, "node") == 0 &&
+          parse_int(name.substr(4), info.node))
+        break;
+    }
+    closedir(dir);
+  }
+
+  return true;
+}
+
+const std::vector<topology_cpu_t> &topology_cpus() {
+  static const std::vector<topology_cpu_t> cpus = [] {
+    std::vector<topology_cpu_t> cpus;
+    std::string line;
+
+    std::vector<int> online;
+    if (read_line(TOPOLOGY_SYSFS_PATH "/online", line) &&
+        parse_cpu_list(line, online)) {
+      for (int cpu : online) {
+        // until proven otherwise, every CPU is a core and cache of its own
+        topology_cpu_t info = {cpu, 0, cpu, cpu, 0};
+        if (!read_cpu(info)) {
+          // NOTE: with the topology unknown the workers are left to float
+          cpus.clear();
+          break;
+        }
+        cpus.push_back(info);
+      }
+    }
+
+    dispatch_printf("topology_cpus: %d online\n", (int)cpus.size());
+
+    return cpus;
+  }();
+
+  return cpus;
+}
+
+int topology_cache_domain(int cpu) {
+  for (const topology_cpu_t &info : topology_cpus()) {
+    if (info.cpu == cpu) return info.cache_domain;
+  }
+  return -1;
+}
+
+std::vector<int> topology_placement(const std::vector<int> &cpu_set) {
+  std::vector<topology_cpu_t> cpus;
+  std::vector<int> placement;
+
+  for (const topology_cpu_t &info : topology_cpus()) {
+    if (cpu_set.empty() ||
+        std::find(cpu_set.begin(), cpu_set.end(), info.cpu) != cpu_set.end())
+      cpus.push_back(info);
+  }
+
+  // spread across physical cores first, then group by node and cache domain
+  std::sort(cpus.begin(), cpus.end(),
+            [](const topology_cpu_t &a, const topology_cpu_t &b) {
+              return std::tie(a.thread, a.node, a.cache_domain, a.core, a.cpu) <
+                     std::tie(b.thread, b.node, b.cache_domain, b.core, b.cpu);
+            });
+
+  for (const topology_cpu_t &info : cpus) placement.push_back(info.cpu);
+
+  return placement;
+}
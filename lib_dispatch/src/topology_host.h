@@ -0,0 +1,30 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_TOPOLOGY_HOST_H_
+#define DISPATCH_TOPOLOGY_HOST_H_
+
+#include <vector>
+
+typedef struct topology_cpu_struct topology_cpu_t;
+struct topology_cpu_struct {
+  int cpu;           // logical CPU number
+  int node;          // NUMA node
+  int cache_domain;  // lowest numbered CPU sharing the last level cache
+  int core;          // lowest numbered CPU sharing the physical core
+  int thread;        // index of the CPU among its core's hardware threads
+};
+
+// Returns the online CPUs, read once from /sys/devices/system/cpu
+const std::vector<topology_cpu_t> &topology_cpus();
+
+// Returns the lowest numbered CPU sharing the last level cache with cpu, -1
+// if cpu is not online
+int topology_cache_domain(int cpu);
+
+// Returns the CPUs of cpu_set (all online CPUs if empty) in the order that
+// workers should be placed on them.  Physical cores are used before their
+// additional hardware threads, and CPUs that share a NUMA node and last level
+// cache are kept next to each other.
+std::vector<int> topology_placement(const std::vector<int> &cpu_set);
+
+#endif  // DISPATCH_TOPOLOGY_HOST_H_
@@ -0,0 +1,30 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#ifndef DISPATCH_WORKER_HOST_H_
+#define DISPATCH_WORKER_HOST_H_
+
+// tuning of the x86 queue's workers, shared with the tests
+
+// most tasks a worker takes from the deque with one acquisition of the lock
+#ifndef DISPATCH_WORKER_BATCH_SIZE
+#define DISPATCH_WORKER_BATCH_SIZE (8)
+#endif
+
+// most tasks a worker keeps on its local stack, the tasks its own tasks
+// added that were displaced from its next slot
+#ifndef DISPATCH_WORKER_LOCAL_SIZE
+#define DISPATCH_WORKER_LOCAL_SIZE (4)
+#endif
+
+// most local tasks a worker performs in a row while the deque has work
+#ifndef DISPATCH_WORKER_LOCAL_RUNS
+#define DISPATCH_WORKER_LOCAL_RUNS (16)
+#endif
+
+// time (in microseconds) a task waits in the next slot of a worker that is
+// performing a long task before an idle worker steals it
+#ifndef DISPATCH_WORKER_NEXT_STEAL_US
+#define DISPATCH_WORKER_NEXT_STEAL_US (1000)
+#endif
+
+#endif  // DISPATCH_WORKER_HOST_H_
@@ -105,7 +105,13 @@ typedef pthread_mutex_t *dispatch_mutex_t;
 #define dispatch_malloc(A) malloc(A)
 #define dispatch_free(A) free(A)
 
+// NOTE: the benchmark build leaves out the trace, so the benchmarks do not
+//       time the writes to stdout
+#if DISPATCH_BENCHMARK
+#define dispatch_printf(...)
+#else
 #define dispatch_printf(...) printf(__VA_ARGS__)
+#endif
 
 static inline dispatch_mutex_t dispatch_mutex_create() {
   pthread_mutex_t *mutex =
@@ -38,9 +38,14 @@ static void RunTests(void* unused) {
 
 #if defined(HOST)
 static void RunTests(void* unused) {
+#if DISPATCH_BENCHMARK
+  RUN_TEST_GROUP(dispatch_benchmark_host);
+#else
   RUN_TEST_GROUP(dispatch_task);
   RUN_TEST_GROUP(dispatch_group);
   RUN_TEST_GROUP(dispatch_queue);
+  RUN_TEST_GROUP(dispatch_queue_host);
+#endif
   UnityEnd();
 }
 #endif
@@ -82,8 +82,35 @@ TEST(dispatch_group, test_perform_functions) {
   dispatch_group_delete(group);
 }
 
+TEST(dispatch_group, test_grow) {
+  const int kLength = 2;
+  const int kTaskCount = 20;
+  dispatch_group_t *group;
+  dispatch_task_t *tasks[kTaskCount];
+  test_work_arg_t arg;
+
+  arg.count = 0;
+
+  // the group grows past its initial length
+  group = dispatch_group_create(kLength, false);
+
+  for (int i = 0; i < kTaskCount; i++) {
+    tasks[i] = dispatch_group_function_add(group, do_dispatch_group_work, &arg);
+  }
+  dispatch_group_perform(group);
+
+  TEST_ASSERT_EQUAL_INT(kTaskCount, arg.count);
+
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_task_delete(tasks[i]);
+  }
+
+  dispatch_group_delete(group);
+}
+
 TEST_GROUP_RUNNER(dispatch_group) {
   RUN_TEST_CASE(dispatch_group, test_create);
   RUN_TEST_CASE(dispatch_group, test_perform_tasks);
   RUN_TEST_CASE(dispatch_group, test_perform_functions);
+  RUN_TEST_CASE(dispatch_group, test_grow);
 }
\ No newline at end of file
@@ -0,0 +1,1278 @@
+// Copyright 2021 XMOS LIMITED. This Software is subject to the terms of the 
+// XMOS Public License: Version 1
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dispatch.h"
+#include "dispatch_config.h"
+#include "test_dispatch_queue.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include "worker_host.h"
+
+typedef struct test_blocking_arg {
+  volatile int released;
+  volatile int count;
+} test_blocking_arg_t;
+
+static void sleep_briefly() {
+  struct timespec ts_sleep = {0, 1000000};
+  nanosleep(&ts_sleep, NULL);
+}
+
+DISPATCH_TASK_FUNCTION
+void do_blocking_work(void *p) {
+  test_blocking_arg_t *arg = (test_blocking_arg_t *)p;
+
+  // block until another task releases us
+  while (!arg->released) sleep_briefly();
+  arg->count++;
+}
+
+DISPATCH_TASK_FUNCTION
+void do_compensated_blocking_work(void *p) {
+  dispatch_worker_blocking_begin();
+  do_blocking_work(p);
+  dispatch_worker_blocking_end();
+}
+
+DISPATCH_TASK_FUNCTION
+void do_release_work(void *p) {
+  test_blocking_arg_t *arg = (test_blocking_arg_t *)p;
+
+  arg->released = 1;
+}
+
+static void *release_later(void *p) {
+  test_blocking_arg_t *arg = (test_blocking_arg_t *)p;
+
+  for (int i = 0; i < 20; i++) sleep_briefly();
+  arg->released = 1;
+  return NULL;
+}
+
+DISPATCH_TASK_FUNCTION
+void do_cpu_work(void *p) {
+#if defined(__linux__)
+  *(volatile int *)p = sched_getcpu();
+#endif
+}
+
+typedef struct test_sched_arg {
+  size_t stack_size;
+  int policy;
+  int nice;
+} test_sched_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_sched_work(void *p) {
+  test_sched_arg_t *arg = (test_sched_arg_t *)p;
+  struct sched_param param;
+
+  pthread_getschedparam(pthread_self(), &arg->policy, &param);
+#if defined(__linux__)
+  pthread_attr_t attr;
+  pthread_getattr_np(pthread_self(), &attr);
+  pthread_attr_getstacksize(&attr, &arg->stack_size);
+  pthread_attr_destroy(&attr);
+  arg->nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+#endif
+}
+
+DISPATCH_TASK_FUNCTION
+void do_counted_work(void *p) {
+  __atomic_add_fetch((int *)p, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct test_group_builder_arg {
+  dispatch_group_t *group;
+  int *count;
+  int task_count;
+} test_group_builder_arg_t;
+
+static void *build_group(void *p) {
+  test_group_builder_arg_t *arg = (test_group_builder_arg_t *)p;
+
+  for (int i = 0; i < arg->task_count; i++) {
+    dispatch_group_function_add(arg->group, do_counted_work, arg->count);
+  }
+  return NULL;
+}
+
+typedef struct test_scratch_arg {
+  int allocated;  // tasks that got all of their scratch memory
+  int aligned;    // tasks whose scratch memory was aligned and disjoint
+} test_scratch_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_scratch_work(void *p) {
+  test_scratch_arg_t *arg = (test_scratch_arg_t *)p;
+  char *first = dispatch_scratch_alloc(300);
+  char *second = dispatch_scratch_alloc(301);
+
+  if (first && second) {
+    memset(first, 1, 300);
+    memset(second, 2, 301);
+    arg->allocated++;
+    if (((uintptr_t)second % sizeof(void *)) == 0 && second >= first + 300)
+      arg->aligned++;
+  }
+  // more than the arena has left
+  if (dispatch_scratch_alloc(1024) != NULL) arg->allocated--;
+}
+
+// fixed-size block pool, larger requests fall back to malloc
+#define TEST_POOL_BLOCK_SIZE (256)
+#define TEST_POOL_BLOCK_COUNT (4096)
+
+typedef struct test_pool {
+  pthread_mutex_t lock;
+  void *free_list;   // next free block
+  char *blocks;      // TEST_POOL_BLOCK_COUNT blocks
+  int outstanding;   // blocks and fallbacks not yet freed
+  int malloc_count;  // number of allocations
+} test_pool_t;
+
+DISPATCH_ALLOCATOR_FUNCTION
+static void *pool_malloc(void *context, size_t size) {
+  test_pool_t *pool = (test_pool_t *)context;
+  void *ptr = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->outstanding++;
+  pool->malloc_count++;
+  if (size <= TEST_POOL_BLOCK_SIZE && pool->free_list) {
+    ptr = pool->free_list;
+    pool->free_list = *(void **)ptr;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return ptr ? ptr : malloc(size);
+}
+
+DISPATCH_ALLOCATOR_FUNCTION
+static void pool_free(void *context, void *ptr) {
+  test_pool_t *pool = (test_pool_t *)context;
+  char *block = (char *)ptr;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->outstanding--;
+  if (block >= pool->blocks &&
+      block < pool->blocks + TEST_POOL_BLOCK_SIZE * TEST_POOL_BLOCK_COUNT) {
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    ptr = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (ptr) free(ptr);
+}
+
+static void pool_init(test_pool_t *pool) {
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->blocks = malloc(TEST_POOL_BLOCK_SIZE * TEST_POOL_BLOCK_COUNT);
+  pool->free_list = NULL;
+  for (int i = TEST_POOL_BLOCK_COUNT - 1; i >= 0; i--) {
+    void **block = (void **)&pool->blocks[TEST_POOL_BLOCK_SIZE * i];
+    *block = pool->free_list;
+    pool->free_list = block;
+  }
+  pool->outstanding = 0;
+  pool->malloc_count = 0;
+}
+
+static void pool_deinit(test_pool_t *pool) {
+  free(pool->blocks);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+// Runs the queue test workload, returns the elapsed time in microseconds
+static long run_allocator_workload(const dispatch_allocator_t *allocator) {
+  const int kRoundCount = 200;
+  const int kTaskCount = 10;
+  const int kThreadCount = 3;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  dispatch_task_t *tasks[kTaskCount];
+  struct timespec begin, end;
+  int count = 0;
+
+  dispatch_allocator_set(allocator);
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  dispatch_queue_attr_init(&attr);
+  attr.allocator = allocator;
+  queue = dispatch_queue_create_with_attr(kTaskCount, kThreadCount, &attr);
+
+  // waitable tasks, groups and non-waitable tasks each round
+  for (int i = 0; i < kRoundCount; i++) {
+    for (int j = 0; j < kTaskCount; j++) {
+      tasks[j] = dispatch_queue_function_add(queue, do_counted_work, &count,
+                                             true);
+    }
+    dispatch_wait_all(tasks, kTaskCount);
+
+    group = dispatch_group_create(kTaskCount, true);
+    for (int j = 0; j < kTaskCount; j++) {
+      dispatch_group_function_add(group, do_counted_work, &count);
+    }
+    dispatch_queue_group_add(queue, group);
+    dispatch_queue_group_wait(queue, group);
+    dispatch_group_delete(group);
+
+    for (int j = 0; j < kTaskCount; j++) {
+      dispatch_queue_function_add(queue, do_counted_work, &count, false);
+    }
+    dispatch_queue_wait(queue);
+  }
+
+  dispatch_queue_delete(queue);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  dispatch_allocator_set(NULL);
+
+  TEST_ASSERT_EQUAL_INT(3 * kRoundCount * kTaskCount, count);
+
+  return (end.tv_sec - begin.tv_sec) * 1000000 +
+         (end.tv_nsec - begin.tv_nsec) / 1000;
+}
+
+// Adds a task created by the queue, from its task table if it has one
+static dispatch_task_t *queue_function_add(dispatch_queue_t *queue,
+                                           dispatch_function_t function,
+                                           void *argument, bool waitable) {
+  dispatch_task_t *task =
+      dispatch_queue_task_create(queue, function, argument, waitable);
+
+  dispatch_queue_task_add(queue, task);
+  return task;
+}
+
+static long run_task_table_workload(size_t task_table_length) {
+  const int kRoundCount = 200;
+  const int kTaskCount = 64;
+  const int kThreadCount = 3;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_task_t *tasks[kTaskCount];
+  struct timespec begin, end;
+  int count = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.task_table_length = task_table_length;
+  queue = dispatch_queue_create_with_attr(kTaskCount, kThreadCount, &attr);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  // deep queues of waitable and non-waitable tasks each round
+  for (int i = 0; i < kRoundCount; i++) {
+    for (int j = 0; j < kTaskCount; j++) {
+      tasks[j] = queue_function_add(queue, do_counted_work, &count, true);
+    }
+    dispatch_wait_all(tasks, kTaskCount);
+
+    for (int j = 0; j < kTaskCount; j++) {
+      queue_function_add(queue, do_counted_work, &count, false);
+    }
+    dispatch_queue_wait(queue);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  dispatch_queue_delete(queue);
+
+  TEST_ASSERT_EQUAL_INT(2 * kRoundCount * kTaskCount, count);
+
+  return (end.tv_sec - begin.tv_sec) * 1000000 +
+         (end.tv_nsec - begin.tv_nsec) / 1000;
+}
+
+typedef struct test_producer_arg {
+  dispatch_queue_t *queue;
+  int *count;
+  int task_count;
+} test_producer_arg_t;
+
+static void *produce_tasks(void *p) {
+  test_producer_arg_t *arg = (test_producer_arg_t *)p;
+
+  for (int i = 0; i < arg->task_count; i++) {
+    queue_function_add(arg->queue, do_counted_work, arg->count, false);
+  }
+  return NULL;
+}
+
+// one producer per worker, the same number of tasks in total whatever the
+// thread count
+static long run_shard_workload(size_t thread_count, size_t shard_count) {
+  const int kTotalTaskCount = 160000;
+  const int kTaskCount = kTotalTaskCount / thread_count;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  pthread_t threads[thread_count];
+  test_producer_arg_t arg;
+  struct timespec begin, end;
+  int count = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.shard_count = shard_count;
+  queue = dispatch_queue_create_with_attr(kTaskCount, thread_count, &attr);
+  dispatch_queue_prewarm(queue);
+
+  arg.queue = queue;
+  arg.count = &count;
+  arg.task_count = kTaskCount;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (size_t i = 0; i < thread_count; i++) {
+    pthread_create(&threads[i], NULL, produce_tasks, &arg);
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  dispatch_queue_wait(queue);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  dispatch_queue_delete(queue);
+
+  TEST_ASSERT_EQUAL_INT(thread_count * kTaskCount, count);
+
+  return (end.tv_sec - begin.tv_sec) * 1000000 +
+         (end.tv_nsec - begin.tv_nsec) / 1000;
+}
+
+static long run_single_producer_workload(bool single_producer) {
+  const int kTaskCount = 100000;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  struct timespec begin, end;
+  int count = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.single_producer = single_producer;
+  queue = dispatch_queue_create_with_attr(1024, 2, &attr);
+  dispatch_queue_prewarm(queue);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_counted_work, &count, false);
+  }
+  dispatch_queue_wait(queue);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  dispatch_queue_delete(queue);
+
+  TEST_ASSERT_EQUAL_INT(kTaskCount, count);
+
+  return (end.tv_sec - begin.tv_sec) * 1000000 +
+         (end.tv_nsec - begin.tv_nsec) / 1000;
+}
+
+typedef struct test_order_arg {
+  int *order;  // indices of the tasks in the order they were performed
+  int *count;  // number of tasks performed
+  int index;
+} test_order_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_ordered_work(void *p) {
+  test_order_arg_t *arg = (test_order_arg_t *)p;
+
+  arg->order[(*arg->count)++] = arg->index;
+}
+
+typedef struct test_chain_arg {
+  dispatch_queue_t *queue;
+  pthread_t thread;  // the worker that performed the first task
+  int length;        // number of tasks in the chain
+  int count;         // number of tasks performed
+  int moved;         // tasks performed by another worker than the first
+} test_chain_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_chained_work(void *p) {
+  test_chain_arg_t *arg = (test_chain_arg_t *)p;
+
+  if (arg->count++ == 0) arg->thread = pthread_self();
+  if (!pthread_equal(arg->thread, pthread_self())) arg->moved++;
+  // each task adds the next one in the chain
+  if (arg->count < arg->length) {
+    dispatch_queue_function_add(arg->queue, do_chained_work, arg, false);
+  }
+}
+
+typedef struct test_spawn_arg {
+  dispatch_queue_t *queue;
+  int count;       // number of children performed
+  int stolen;      // children performed while the parent was still running
+  int completed;   // waited for children that completed
+} test_spawn_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_spawning_work(void *p) {
+  test_spawn_arg_t *arg = (test_spawn_arg_t *)p;
+
+  // the last child waits in this worker's next slot, the others are left
+  // for the idle worker to steal while this task spins
+  for (int i = 0; i < 3; i++) {
+    dispatch_queue_function_add(arg->queue, do_counted_work, &arg->count,
+                                false);
+  }
+  for (int i = 0; i < 5000; i++) {
+    if (__atomic_load_n(&arg->count, __ATOMIC_RELAXED) == 3) break;
+    sleep_briefly();
+  }
+  arg->stolen = __atomic_load_n(&arg->count, __ATOMIC_RELAXED);
+}
+
+DISPATCH_TASK_FUNCTION
+void do_waiting_work(void *p) {
+  test_spawn_arg_t *arg = (test_spawn_arg_t *)p;
+  dispatch_task_t *task;
+
+  // the child is given back to the queue while this task waits on it
+  task = dispatch_queue_function_add(arg->queue, do_counted_work, &arg->count,
+                                     true);
+  dispatch_queue_task_wait(arg->queue, task);
+  arg->completed++;
+}
+
+TEST_GROUP(dispatch_queue_host);
+
+TEST_SETUP(dispatch_queue_host) {}
+
+TEST_TEAR_DOWN(dispatch_queue_host) {}
+
+TEST(dispatch_queue_host, test_shared_pool) {
+  const int kQueueCount = 8;
+  const int kTaskCount = 10;
+  dispatch_queue_t *queues[kQueueCount];
+  dispatch_task_t *tasks[kQueueCount];
+  dispatch_group_t *group;
+  // the last two args of each queue are for the waitable and group tasks
+  test_parallel_work_arg args[kQueueCount][kTaskCount + 2];
+
+  // many logical queues share one pool of workers
+  for (int i = 0; i < kQueueCount; i++) {
+    queues[i] = dispatch_queue_create_shared(kTaskCount);
+    for (int j = 0; j < kTaskCount + 2; j++) {
+      args[i][j].begin = 0;
+      args[i][j].end = 1000;
+      args[i][j].count = 0;
+    }
+    for (int j = 0; j < kTaskCount; j++) {
+      dispatch_queue_function_add(queues[i], do_parallel_work, &args[i][j],
+                                  false);
+    }
+  }
+
+  // waitable tasks and groups work on logical queues
+  group = dispatch_group_create(kQueueCount, true);
+  for (int i = 0; i < kQueueCount; i++) {
+    tasks[i] = dispatch_queue_function_add(queues[i], do_parallel_work,
+                                           &args[i][kTaskCount], true);
+    dispatch_group_function_add(group, do_parallel_work,
+                                &args[i][kTaskCount + 1]);
+  }
+  dispatch_queue_group_add(queues[0], group);
+
+  for (int i = 0; i < kQueueCount; i++) {
+    dispatch_queue_task_wait(queues[i], tasks[i]);
+  }
+  dispatch_queue_group_wait(queues[0], group);
+
+  for (int i = 0; i < kQueueCount; i++) {
+    dispatch_queue_wait(queues[i]);
+    for (int j = 0; j < kTaskCount + 2; j++) {
+      TEST_ASSERT_EQUAL_INT(1000, args[i][j].count);
+    }
+  }
+
+  dispatch_group_delete(group);
+  for (int i = 0; i < kQueueCount; i++) {
+    dispatch_queue_delete(queues[i]);
+  }
+
+  // deleting a logical queue drains its waiting tasks
+  int count = 0;
+  queues[0] = dispatch_queue_create_shared(kTaskCount);
+  for (int j = 0; j < kTaskCount; j++) {
+    dispatch_queue_function_add(queues[0], do_counted_work, &count, false);
+  }
+  dispatch_queue_delete(queues[0]);
+  TEST_ASSERT_EQUAL_INT(kTaskCount, count);
+}
+
+TEST(dispatch_queue_host, test_blocking_pool) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  test_blocking_arg_t arg;
+
+  // a single worker would deadlock if it ran the blocking task
+  queue = dispatch_queue_create(10, 1, 0, 0);
+
+  arg.released = 0;
+  arg.count = 0;
+
+  task = dispatch_task_create(do_blocking_work, &arg, false);
+  dispatch_queue_blocking_add(queue, task);
+  task = dispatch_queue_function_add(queue, do_release_work, &arg, true);
+  dispatch_queue_task_wait(queue, task);
+
+  // the queue wait includes the blocking task
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(1, arg.count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_blocking_compensation) {
+  dispatch_queue_t *queue;
+  test_blocking_arg_t arg;
+
+  queue = dispatch_queue_create(10, 1, 0, 0);
+
+  arg.released = 0;
+  arg.count = 0;
+
+  // the only worker blocks, a temporary worker runs the release task
+  dispatch_queue_function_add(queue, do_compensated_blocking_work, &arg,
+                              false);
+  dispatch_queue_function_add(queue, do_release_work, &arg, false);
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(1, arg.count);
+
+  dispatch_queue_delete(queue);
+}
+
+typedef struct test_retire_arg {
+  dispatch_queue_t *queue;
+  int stops;  // number of workers stopped
+  int count;  // number of tasks added by the stop hook that were performed
+} test_retire_arg_t;
+
+static void stop_retiring_worker(void *argument, void *context) {
+  test_retire_arg_t *arg = (test_retire_arg_t *)argument;
+
+  // a stop hook may add tasks and block, the first one adds more tasks than
+  // there are idle workers
+  if (__atomic_fetch_add(&arg->stops, 1, __ATOMIC_SEQ_CST) == 0) {
+    for (int i = 0; i < 2; i++) {
+      dispatch_queue_function_add(arg->queue, do_counted_work, &arg->count,
+                                  false);
+    }
+  }
+  dispatch_worker_blocking_begin();
+  dispatch_worker_blocking_end();
+}
+
+TEST(dispatch_queue_host, test_retiring_worker) {
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  test_blocking_arg_t arg;
+  test_retire_arg_t retire = {NULL, 0, 0};
+
+  dispatch_queue_attr_init(&attr);
+  attr.worker_stop = stop_retiring_worker;
+  attr.worker_argument = &retire;
+  queue = dispatch_queue_create_with_attr(10, 1, &attr);
+  retire.queue = queue;
+
+  // the temporary worker started for the blocked worker retires once the
+  // blocking ends, the second time around it is joined by the next start
+  for (int i = 0; i < 2; i++) {
+    arg.released = 0;
+    arg.count = 0;
+    dispatch_queue_function_add(queue, do_compensated_blocking_work, &arg,
+                                false);
+    dispatch_queue_function_add(queue, do_release_work, &arg, false);
+    dispatch_queue_wait(queue);
+    TEST_ASSERT_EQUAL_INT(1, arg.count);
+  }
+
+  // the tasks added by the stop hook are performed
+  for (int i = 0; i < 5000; i++) {
+    if (__atomic_load_n(&retire.count, __ATOMIC_RELAXED) == 2) break;
+    sleep_briefly();
+  }
+  dispatch_queue_wait(queue);
+  TEST_ASSERT(__atomic_load_n(&retire.stops, __ATOMIC_SEQ_CST) >= 1);
+  TEST_ASSERT_EQUAL_INT(2, retire.count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_far_deadline) {
+  // beyond INT64_MAX nanoseconds in microseconds, the steady clock counts
+  // from boot so a deadline this far out must not be clamped into the past
+  const dispatch_time_t kDeadline = (dispatch_time_t)INT64_MAX / 1000 + 1;
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  test_blocking_arg_t arg;
+  pthread_t thread;
+
+  queue = dispatch_queue_create(1, 1, 0, 0);
+
+  arg.released = 0;
+  arg.count = 0;
+  task = dispatch_queue_function_add(queue, do_blocking_work, &arg, true);
+  pthread_create(&thread, NULL, release_later, &arg);
+
+  // the wait lasts until the task is released rather than timing out
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_SUCCESS,
+                        dispatch_queue_task_wait_until(queue, task, kDeadline));
+  TEST_ASSERT_EQUAL_INT(1, arg.count);
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_SUCCESS,
+                        dispatch_queue_wait_until(queue, kDeadline));
+
+  pthread_join(thread, NULL);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_batched_dequeue) {
+  const int kTaskCount = 6;
+  dispatch_queue_t *queue;
+  test_blocking_arg_t gate;
+  test_blocking_arg_t arg;
+  int count = 0;
+
+  queue = dispatch_queue_create(10, 1, 0, 0);
+
+  gate.released = 0;
+  gate.count = 0;
+  arg.released = 0;
+  arg.count = 0;
+
+  // hold the only worker so the next tasks are taken as one batch, the
+  // blocking task returns the rest of the batch so the release task can run
+  dispatch_queue_function_add(queue, do_blocking_work, &gate, false);
+  dispatch_queue_function_add(queue, do_compensated_blocking_work, &arg,
+                              false);
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_counted_work, &count, false);
+  }
+  dispatch_queue_function_add(queue, do_release_work, &arg, false);
+  gate.released = 1;
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(1, gate.count);
+  TEST_ASSERT_EQUAL_INT(1, arg.count);
+  TEST_ASSERT_EQUAL_INT(kTaskCount, count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_local_tasks) {
+  // NOTE: a longer chain is queued behind the deque and may move
+  const int kChainLength = DISPATCH_WORKER_LOCAL_RUNS;
+  dispatch_queue_t *queue;
+  test_chain_arg_t chain;
+  test_spawn_arg_t spawn;
+
+  queue = dispatch_queue_create(10, 4, 0, 0);
+  dispatch_queue_prewarm(queue);
+
+  // a chain of tasks that each add the next stays on one worker
+  memset(&chain, 0, sizeof(chain));
+  chain.queue = queue;
+  chain.length = kChainLength;
+  dispatch_queue_function_add(queue, do_chained_work, &chain, false);
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(kChainLength, chain.count);
+  TEST_ASSERT_EQUAL_INT(0, chain.moved);
+
+  // the children displaced from the next slot are stolen at once, the one in
+  // the next slot after the steal delay
+  memset(&spawn, 0, sizeof(spawn));
+  spawn.queue = queue;
+  dispatch_queue_function_add(queue, do_spawning_work, &spawn, false);
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(3, spawn.stolen);
+  TEST_ASSERT_EQUAL_INT(3, spawn.count);
+
+  // a task can wait on a task it added
+  memset(&spawn, 0, sizeof(spawn));
+  spawn.queue = queue;
+  dispatch_queue_function_add(queue, do_waiting_work, &spawn, false);
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(1, spawn.completed);
+  TEST_ASSERT_EQUAL_INT(1, spawn.count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_placement) {
+  const int kTaskCount = 16;
+  const dispatch_placement_t placements[] = {DISPATCH_PLACEMENT_NONE,
+                                             DISPATCH_PLACEMENT_TOPOLOGY};
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  int cpus[kTaskCount];
+
+#if defined(__linux__)
+  int cpu = sched_getcpu();
+#else
+  int cpu = 0;
+#endif
+
+  for (int p = 0; p < 2; p++) {
+    // restrict the workers to the CPU the test is running on
+    dispatch_queue_attr_init(&attr);
+    attr.cpu_set = &cpu;
+    attr.cpu_set_size = 1;
+    attr.placement = placements[p];
+    queue = dispatch_queue_create_with_attr(kTaskCount, 4, &attr);
+
+    for (int i = 0; i < kTaskCount; i++) {
+      cpus[i] = cpu;
+      dispatch_queue_function_add(queue, do_cpu_work, &cpus[i], false);
+    }
+    dispatch_queue_wait(queue);
+
+    for (int i = 0; i < kTaskCount; i++) {
+      TEST_ASSERT_EQUAL_INT(cpu, cpus[i]);
+    }
+
+    dispatch_queue_delete(queue);
+  }
+}
+
+TEST(dispatch_queue_host, test_thread_attributes) {
+  const size_t kStackSize = 16 * 1024;  // in words
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  test_sched_arg_t arg = {0, -1, 0};
+  int nice = 0;
+
+#if defined(__linux__)
+  // the workers inherit this thread's nice level
+  nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+#endif
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = kStackSize;
+  attr.thread_policy = DISPATCH_SCHED_RR;
+  attr.thread_priority = 1;
+  attr.thread_nice = 1;
+  queue = dispatch_queue_create_with_attr(1, 1, &attr);
+
+  task = dispatch_queue_function_add(queue, do_sched_work, &arg, true);
+  dispatch_queue_task_wait(queue, task);
+
+  // real-time scheduling falls back to the default without permission
+  TEST_ASSERT(arg.policy == SCHED_RR || arg.policy == SCHED_OTHER);
+#if defined(__linux__)
+  // the stack is at least the requested size
+  TEST_ASSERT(arg.stack_size >= kStackSize * sizeof(void *));
+  // NOTE: the kernel caps the nice level at 19
+  if (arg.policy == SCHED_OTHER)
+    TEST_ASSERT_EQUAL_INT(nice < 19 ? nice + 1 : 19, arg.nice);
+#endif
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_worker_create_failure) {
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+
+  // a stack too large to map makes every worker's thread fail to start
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = (size_t)1 << 43;  // in words
+  queue = dispatch_queue_create_with_attr(1, 2, &attr);
+
+  // the failed starts are undone, so prewarming gives up and the queue can
+  // be deleted
+  dispatch_queue_prewarm(queue);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_payload_completion) {
+  dispatch_completion_t *completion;
+  dispatch_task_t *task;
+  void *payload;
+  int status;
+
+  // reaping would free the payload with the task, so binding a payload task
+  // fails an assert, which aborts a forked child
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    completion = dispatch_completion_create(4);
+    task = dispatch_task_create_with_payload(do_counted_work, sizeof(int),
+                                             &payload, false);
+    dispatch_task_set_completion(task, completion);
+    _exit(0);
+  }
+
+  TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+  TEST_ASSERT_TRUE(WIFSIGNALED(status));
+  TEST_ASSERT_EQUAL_INT(SIGABRT, WTERMSIG(status));
+}
+
+TEST(dispatch_queue_host, test_completion_overflow) {
+  dispatch_completion_t *completion;
+  dispatch_queue_t *queue;
+  int count = 0;
+  int status;
+
+  // more unreaped tasks than the ring holds fails an assert in the worker,
+  // which aborts a forked child
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    queue = dispatch_queue_create(4, 1, 0, 0);
+    completion = dispatch_completion_create(2);
+    for (int i = 0; i < 3; i++) {
+      dispatch_completion_function_add(queue, completion, do_counted_work,
+                                       &count);
+    }
+    dispatch_queue_wait(queue);
+    _exit(0);
+  }
+
+  TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+  TEST_ASSERT_TRUE(WIFSIGNALED(status));
+  TEST_ASSERT_EQUAL_INT(SIGABRT, WTERMSIG(status));
+}
+
+TEST(dispatch_queue_host, test_concurrent_group) {
+  const int kThreadCount = 4;
+  const int kTaskCount = 100;
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  pthread_t threads[kThreadCount];
+  test_group_builder_arg_t arg;
+  int count = 0;
+
+  queue = dispatch_queue_create(10, 3, 0, 0);
+  group = dispatch_group_create(1, true);
+
+  // several threads populate the group without a lock
+  arg.group = group;
+  arg.count = &count;
+  arg.task_count = kTaskCount;
+  for (int i = 0; i < kThreadCount; i++) {
+    pthread_create(&threads[i], NULL, build_group, &arg);
+  }
+  for (int i = 0; i < kThreadCount; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  dispatch_queue_group_add(queue, group);
+  dispatch_queue_group_wait(queue, group);
+  TEST_ASSERT_EQUAL_INT(kThreadCount * kTaskCount, count);
+
+  dispatch_group_delete(group);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_scratch) {
+  const int kTaskCount = 5;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  test_scratch_arg_t arg = {0, 0};
+
+  dispatch_queue_attr_init(&attr);
+  attr.scratch_size = 1024;
+  queue = dispatch_queue_create_with_attr(kTaskCount, 1, &attr);
+
+  // the arena is reset after each task, so every task fits
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_scratch_work, &arg, false);
+  }
+  dispatch_queue_wait(queue);
+
+  TEST_ASSERT_EQUAL_INT(kTaskCount, arg.allocated);
+  TEST_ASSERT_EQUAL_INT(kTaskCount, arg.aligned);
+  TEST_ASSERT(dispatch_queue_scratch_high_watermark(queue) >= 601);
+  TEST_ASSERT(dispatch_queue_scratch_high_watermark(queue) <= 1024);
+
+  // not called from a worker
+  TEST_ASSERT_NULL(dispatch_scratch_alloc(1));
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_allocator) {
+  test_pool_t pool;
+  dispatch_allocator_t allocator;
+  dispatch_queue_t *first;
+  dispatch_queue_t *queue;
+
+  pool_init(&pool);
+  allocator.malloc = pool_malloc;
+  allocator.free = pool_free;
+  allocator.context = &pool;
+
+  run_allocator_workload(&allocator);
+
+  // everything was allocated from the pool and freed back to it
+  TEST_ASSERT(pool.malloc_count > 0);
+  TEST_ASSERT_EQUAL_INT(0, pool.outstanding);
+
+  // a shared queue is allocated from the global allocator, the first shared
+  // queue creates the pool's workers so they are not counted
+  first = dispatch_queue_create_shared(4);
+  dispatch_allocator_set(&allocator);
+  pool.malloc_count = 0;
+  queue = dispatch_queue_create_shared(4);
+  TEST_ASSERT(pool.malloc_count > 0);
+  dispatch_queue_delete(queue);
+  dispatch_allocator_set(NULL);
+  dispatch_queue_delete(first);
+  TEST_ASSERT_EQUAL_INT(0, pool.outstanding);
+  // the default was restored
+  TEST_ASSERT(dispatch_allocator_get() != &allocator);
+
+  pool_deinit(&pool);
+}
+
+TEST(dispatch_queue_host, test_task_table) {
+  const int kTableLength = 8;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_task_t *tasks[kTableLength];
+  dispatch_task_t *extra;
+  int count = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.task_table_length = kTableLength;
+  queue = dispatch_queue_create_with_attr(kTableLength, 2, &attr);
+
+  // a full table falls back to the allocator
+  for (int i = 0; i < kTableLength; i++) {
+    tasks[i] = dispatch_queue_task_create(queue, do_counted_work, &count, true);
+  }
+  extra = dispatch_queue_task_create(queue, do_counted_work, &count, true);
+  dispatch_queue_task_add(queue, extra);
+  for (int i = 0; i < kTableLength; i++) {
+    TEST_ASSERT(extra != tasks[i]);
+    dispatch_queue_task_add(queue, tasks[i]);
+  }
+  dispatch_queue_task_wait(queue, extra);
+  dispatch_wait_all(tasks, kTableLength);
+  TEST_ASSERT_EQUAL_INT(kTableLength + 1, count);
+
+  // deleted tasks are returned to the table
+  for (int i = 0; i < kTableLength; i++) {
+    tasks[i] =
+        dispatch_queue_task_create(queue, do_counted_work, &count, false);
+  }
+  for (int i = 0; i < kTableLength; i++) dispatch_task_delete(tasks[i]);
+  for (int i = 0; i < kTableLength; i++) {
+    dispatch_task_t *task =
+        dispatch_queue_task_create(queue, do_counted_work, &count, false);
+    bool reused = false;
+    for (int j = 0; j < kTableLength; j++) reused |= (task == tasks[j]);
+    TEST_ASSERT(reused);
+    dispatch_queue_task_add(queue, task);
+  }
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(2 * kTableLength + 1, count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_sharded_queue) {
+  const int kTaskCount = 64;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  dispatch_task_t *tasks[kTaskCount];
+  int count = 0;
+
+  // pinned workers poll the shards in cache domain order
+  dispatch_queue_attr_init(&attr);
+  attr.shard_count = 4;
+  attr.placement = DISPATCH_PLACEMENT_TOPOLOGY;
+  queue = dispatch_queue_create_with_attr(kTaskCount, 3, &attr);
+
+  // waitable tasks, a group and the queue wait all see the shards
+  for (int i = 0; i < kTaskCount; i++) {
+    tasks[i] = dispatch_queue_function_add(queue, do_counted_work, &count,
+                                           true);
+  }
+  dispatch_wait_all(tasks, kTaskCount);
+  TEST_ASSERT_EQUAL_INT(kTaskCount, count);
+
+  group = dispatch_group_create(kTaskCount, true);
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_group_function_add(group, do_counted_work, &count);
+  }
+  dispatch_queue_group_add(queue, group);
+  dispatch_queue_group_wait(queue, group);
+  dispatch_group_delete(group);
+  TEST_ASSERT_EQUAL_INT(2 * kTaskCount, count);
+
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_counted_work, &count, false);
+  }
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(3 * kTaskCount, count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue_host, test_single_producer) {
+  const int kLength = 16;
+  const int kTaskCount = 1000;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  dispatch_task_t *tasks[kLength];
+  test_order_arg_t args[kLength];
+  int order[kLength];
+  int count = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.single_producer = true;
+
+  // a single worker performs the ring's tasks in order
+  queue = dispatch_queue_create_with_attr(kLength, 1, &attr);
+  for (int i = 0; i < kLength; i++) {
+    args[i].order = order;
+    args[i].count = &count;
+    args[i].index = i;
+    dispatch_queue_function_add(queue, do_ordered_work, &args[i], false);
+  }
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(kLength, count);
+  for (int i = 0; i < kLength; i++) {
+    TEST_ASSERT_EQUAL_INT(i, order[i]);
+  }
+  dispatch_queue_delete(queue);
+
+  // more tasks than the ring holds overflow to the deque
+  count = 0;
+  queue = dispatch_queue_create_with_attr(kLength, 3, &attr);
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_counted_work, &count, false);
+  }
+  for (int i = 0; i < kLength; i++) {
+    tasks[i] = dispatch_queue_function_add(queue, do_counted_work, &count,
+                                           true);
+  }
+  dispatch_wait_all(tasks, kLength);
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(kTaskCount + kLength, count);
+  dispatch_queue_delete(queue);
+}
+
+TEST_GROUP_RUNNER(dispatch_queue_host) {
+  RUN_TEST_CASE(dispatch_queue_host, test_shared_pool);
+  RUN_TEST_CASE(dispatch_queue_host, test_blocking_pool);
+  RUN_TEST_CASE(dispatch_queue_host, test_blocking_compensation);
+  RUN_TEST_CASE(dispatch_queue_host, test_retiring_worker);
+  RUN_TEST_CASE(dispatch_queue_host, test_far_deadline);
+  RUN_TEST_CASE(dispatch_queue_host, test_batched_dequeue);
+  RUN_TEST_CASE(dispatch_queue_host, test_local_tasks);
+  RUN_TEST_CASE(dispatch_queue_host, test_placement);
+  RUN_TEST_CASE(dispatch_queue_host, test_thread_attributes);
+  RUN_TEST_CASE(dispatch_queue_host, test_worker_create_failure);
+  RUN_TEST_CASE(dispatch_queue_host, test_payload_completion);
+  RUN_TEST_CASE(dispatch_queue_host, test_completion_overflow);
+  RUN_TEST_CASE(dispatch_queue_host, test_concurrent_group);
+  RUN_TEST_CASE(dispatch_queue_host, test_scratch);
+  RUN_TEST_CASE(dispatch_queue_host, test_allocator);
+  RUN_TEST_CASE(dispatch_queue_host, test_task_table);
+  RUN_TEST_CASE(dispatch_queue_host, test_sharded_queue);
+  RUN_TEST_CASE(dispatch_queue_host, test_single_producer);
+}
+
+// NOTE: the benchmarks are only run by the benchmark build, which leaves out
+//       dispatch_printf so the timings do not include writing to stdout
+TEST_GROUP(dispatch_benchmark_host);
+
+TEST_SETUP(dispatch_benchmark_host) {}
+
+TEST_TEAR_DOWN(dispatch_benchmark_host) {}
+
+TEST(dispatch_benchmark_host, test_batched_dequeue) {
+  const int kTaskCount = 100000;
+  dispatch_queue_t *queue;
+  struct timespec begin, end;
+  char message[128];
+  int count = 0;
+
+  queue = dispatch_queue_create(10, 1, 0, 0);
+
+  // tiny tasks behind a deep queue
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < kTaskCount; i++) {
+    dispatch_queue_function_add(queue, do_counted_work, &count, false);
+  }
+  dispatch_queue_wait(queue);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  TEST_ASSERT_EQUAL_INT(kTaskCount, count);
+
+  snprintf(message, sizeof(message), "batched dequeue benchmark: %ldus",
+           (long)((end.tv_sec - begin.tv_sec) * 1000000 +
+                  (end.tv_nsec - begin.tv_nsec) / 1000));
+  TEST_MESSAGE(message);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_benchmark_host, test_local_tasks) {
+  const int kChainLength = 100000;
+  dispatch_queue_t *queue;
+  test_chain_arg_t chain;
+  struct timespec begin, end;
+  char message[128];
+
+  queue = dispatch_queue_create(10, 4, 0, 0);
+  dispatch_queue_prewarm(queue);
+
+  // a long producer-consumer chain
+  memset(&chain, 0, sizeof(chain));
+  chain.queue = queue;
+  chain.length = kChainLength;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  dispatch_queue_function_add(queue, do_chained_work, &chain, false);
+  dispatch_queue_wait(queue);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  TEST_ASSERT_EQUAL_INT(kChainLength, chain.count);
+
+  snprintf(message, sizeof(message), "local tasks benchmark: %ldus",
+           (long)((end.tv_sec - begin.tv_sec) * 1000000 +
+                  (end.tv_nsec - begin.tv_nsec) / 1000));
+  TEST_MESSAGE(message);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_benchmark_host, test_allocator) {
+  test_pool_t pool;
+  dispatch_allocator_t allocator;
+  char message[128];
+  long default_time;
+  long pool_time;
+
+  pool_init(&pool);
+  allocator.malloc = pool_malloc;
+  allocator.free = pool_free;
+  allocator.context = &pool;
+
+  // compares the default allocator with the pool on the same workload
+  default_time = run_allocator_workload(NULL);
+  pool_time = run_allocator_workload(&allocator);
+  snprintf(message, sizeof(message),
+           "allocator benchmark: default=%ldus pool=%ldus", default_time,
+           pool_time);
+  TEST_MESSAGE(message);
+
+  pool_deinit(&pool);
+}
+
+TEST(dispatch_benchmark_host, test_task_table) {
+  char message[128];
+  long pointer_time;
+  long table_time;
+
+  pointer_time = run_task_table_workload(0);
+  table_time = run_task_table_workload(256);
+  snprintf(message, sizeof(message),
+           "task table benchmark: pointers=%ldus table=%ldus", pointer_time,
+           table_time);
+  TEST_MESSAGE(message);
+}
+
+TEST(dispatch_benchmark_host, test_false_sharing) {
+  const int kProducerCount = 4;
+  const int kTaskCount = 20000;
+  const int kThreadCount = 4;
+  dispatch_queue_attr_t attr;
+  dispatch_queue_t *queue;
+  pthread_t threads[kProducerCount];
+  test_producer_arg_t arg;
+  struct timespec begin, end;
+  char message[128];
+  int count = 0;
+
+  // producers write the task table's free list and the lock, workers write
+  // the lock, their scratch arenas and the free list as tasks are deleted.
+  // Building with DISPATCH_CACHE_LINE_SIZE=16 removes the padding, for
+  // comparison.
+  dispatch_queue_attr_init(&attr);
+  attr.task_table_length = 1024;
+  attr.scratch_size = 256;
+  queue = dispatch_queue_create_with_attr(kTaskCount, kThreadCount, &attr);
+  dispatch_queue_prewarm(queue);
+
+  arg.queue = queue;
+  arg.count = &count;
+  arg.task_count = kTaskCount;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < kProducerCount; i++) {
+    pthread_create(&threads[i], NULL, produce_tasks, &arg);
+  }
+  for (int i = 0; i < kProducerCount; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  dispatch_queue_wait(queue);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  TEST_ASSERT_EQUAL_INT(kProducerCount * kTaskCount, count);
+
+  snprintf(message, sizeof(message), "false sharing benchmark: %ldus",
+           (long)((end.tv_sec - begin.tv_sec) * 1000000 +
+                  (end.tv_nsec - begin.tv_nsec) / 1000));
+  TEST_MESSAGE(message);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_benchmark_host, test_sharded_queue) {
+  const size_t kCoreCounts[] = {8, 16, 32};
+  char message[128];
+
+  // many producers on the single mutex against a shard per core
+  for (size_t i = 0; i < sizeof(kCoreCounts) / sizeof(kCoreCounts[0]); i++) {
+    long single = run_shard_workload(kCoreCounts[i], 1);
+    long sharded = run_shard_workload(kCoreCounts[i], kCoreCounts[i]);
+
+    snprintf(message, sizeof(message),
+             "sharded queue benchmark: %d threads, 1 shard %ldus, "
+             "%d shards %ldus",
+             (int)kCoreCounts[i], single, (int)kCoreCounts[i], sharded);
+    TEST_MESSAGE(message);
+  }
+}
+
+TEST(dispatch_benchmark_host, test_single_producer) {
+  char message[128];
+
+  // one producer adding through the lock against the ring
+  long locked = run_single_producer_workload(false);
+  long ring = run_single_producer_workload(true);
+
+  snprintf(message, sizeof(message),
+           "single producer benchmark: locked %ldus, ring %ldus", locked,
+           ring);
+  TEST_MESSAGE(message);
+}
+
+TEST_GROUP_RUNNER(dispatch_benchmark_host) {
+  RUN_TEST_CASE(dispatch_benchmark_host, test_batched_dequeue);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_local_tasks);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_allocator);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_task_table);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_false_sharing);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_sharded_queue);
+  RUN_TEST_CASE(dispatch_benchmark_host, test_single_producer);
+}
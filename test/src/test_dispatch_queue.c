@@ -59,8 +59,122 @@ void do_parallel_work(void *p) {
   for (int i = arg->begin; i < arg->end; i++) arg->count++;
 }
 
+typedef struct test_gated_work_arg {
+  int open;
+  int count;
+} test_gated_work_arg_t;
+
+typedef struct test_graph_work_arg {
+  int count;    // number of times the task was performed
+  int ordered;  // number of times its dependencies were performed first
+  struct test_graph_work_arg *dependencies[2];
+} test_graph_work_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_graph_work(void *p) {
+  test_graph_work_arg_t *arg = (test_graph_work_arg_t *)p;
+  int ordered = 1;
+
+  look_busy(100);
+
+  for (int i = 0; i < 2; i++) {
+    if (arg->dependencies[i] && arg->dependencies[i]->count != arg->count + 1)
+      ordered = 0;
+  }
+  arg->ordered += ordered;
+  arg->count++;
+}
+
+typedef struct test_current_work_arg {
+  dispatch_task_t *task;  // the task the function was performed by
+  int started;            // the function has started
+  int stopped;            // the function saw its task cancelled
+} test_current_work_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_cancellable_work(void *p) {
+  test_current_work_arg_t *arg = (test_current_work_arg_t *)p;
+
+  arg->task = dispatch_task_current();
+  __atomic_store_n(&arg->started, 1, __ATOMIC_SEQ_CST);
+
+  // run until the task is cancelled
+  for (int i = 0; i < 1000; i++) {
+    if (dispatch_task_is_cancelled(dispatch_task_current())) {
+      arg->stopped = 1;
+      return;
+    }
+    look_busy(1);
+  }
+}
+
+typedef struct test_tree_work_arg {
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  struct test_tree_work_arg *nodes;  // the tree in heap order
+  int index;
+  int length;
+  int count;
+} test_tree_work_arg_t;
+
+DISPATCH_TASK_FUNCTION
+void do_tree_work(void *p) {
+  test_tree_work_arg_t *arg = (test_tree_work_arg_t *)p;
+
+  arg->count++;
+
+  // the children are discovered while the group is running
+  for (int i = 2 * arg->index + 1; i <= 2 * arg->index + 2; i++) {
+    if (i < arg->length) {
+      dispatch_queue_grouped_function_add(arg->queue, arg->group,
+                                          do_tree_work, &arg->nodes[i]);
+    }
+  }
+}
+
+DISPATCH_TASK_FUNCTION
+void do_gated_work(void *p) {
+  // NOTE: the "volatile" is needed here or the compiler may optimize this away
+  test_gated_work_arg_t volatile *arg = (test_gated_work_arg_t volatile *)p;
+
+  // spin until the test opens the gate
+  while (!arg->open) continue;
+
+  dispatch_mutex_get(mutex);
+  arg->count++;
+  dispatch_mutex_put(mutex);
+}
+
 TEST_GROUP(dispatch_queue);
 
+static int worker_start_count;
+static int worker_stop_count;
+
+void *start_worker(void *argument) {
+  int *contexts = (int *)argument;
+  int *context;
+
+  dispatch_mutex_get(mutex);
+  context = &contexts[worker_start_count++];
+  dispatch_mutex_put(mutex);
+
+  return context;
+}
+
+void stop_worker(void *argument, void *context) {
+  dispatch_mutex_get(mutex);
+  worker_stop_count++;
+  dispatch_mutex_put(mutex);
+}
+
+DISPATCH_TASK_FUNCTION
+void do_context_work(void *p) {
+  int *context = (int *)dispatch_worker_context();
+
+  // each worker has its own context, so no lock is needed
+  if (context) (*context)++;
+}
+
 TEST_SETUP(dispatch_queue) { mutex = dispatch_mutex_create(); }
 
 TEST_TEAR_DOWN(dispatch_queue) { dispatch_mutex_delete(mutex); }
@@ -89,6 +203,31 @@ TEST(dispatch_queue, test_wait_queue) {
   dispatch_queue_delete(queue);
 }
 
+TEST(dispatch_queue, test_prewarm) {
+  dispatch_queue_t *queue;
+  test_work_arg_t arg;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  arg.count = 0;
+
+  // waiting on a queue that never started a worker must not block
+  dispatch_queue_wait(queue);
+
+  dispatch_queue_prewarm(queue);
+  for (int i = 0; i < kQueueThreadCount; i++) {
+    dispatch_queue_function_add(queue, do_limited_work, &arg, false);
+  }
+  dispatch_queue_wait(queue);
+
+  TEST_ASSERT_EQUAL_INT(kQueueThreadCount, arg.count);
+
+  dispatch_queue_delete(queue);
+}
+
 TEST(dispatch_queue, test_wait_task) {
   dispatch_queue_t *queue;
   dispatch_task_t *task;
@@ -138,6 +277,79 @@ TEST(dispatch_queue, test_wait_group) {
   dispatch_queue_delete(queue);
 }
 
+TEST(dispatch_queue, test_reusable_group) {
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  test_work_arg_t arg;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+  const int kGroupLength = 3;
+  const int kCycleCount = 3;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+  group = dispatch_group_create(kGroupLength, true);
+  dispatch_group_set_reusable(group, true);
+
+  arg.count = 0;
+
+  for (int i = 0; i < kGroupLength; i++) {
+    dispatch_group_function_add(group, do_standard_work, &arg);
+  }
+
+  // the same tasks are submitted every cycle
+  for (int i = 0; i < kCycleCount; i++) {
+    if (i > 0) dispatch_group_reset(group);
+    dispatch_queue_group_add(queue, group);
+    dispatch_queue_group_wait(queue, group);
+    TEST_ASSERT_EQUAL_INT(kGroupLength * (i + 1), arg.count);
+  }
+
+  // the group deletes its tasks
+  dispatch_group_delete(group);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_group_enter_leave) {
+  dispatch_queue_t *queue;
+  dispatch_group_t *group;
+  test_tree_work_arg_t nodes[7];
+  const int kNodeCount = 7;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+  group = dispatch_group_create(0, true);
+
+  // an entered group does not finish until it is left
+  dispatch_group_enter(group);
+  TEST_ASSERT_FALSE(dispatch_queue_group_poll(queue, group));
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_TIMEOUT,
+                        dispatch_queue_group_wait_for(queue, group, 1000));
+  dispatch_group_leave(group);
+  TEST_ASSERT_TRUE(dispatch_queue_group_poll(queue, group));
+
+  // walk a tree, every task adds its children to the group
+  for (int i = 0; i < kNodeCount; i++) {
+    nodes[i].queue = queue;
+    nodes[i].group = group;
+    nodes[i].nodes = nodes;
+    nodes[i].index = i;
+    nodes[i].length = kNodeCount;
+    nodes[i].count = 0;
+  }
+  dispatch_queue_grouped_function_add(queue, group, do_tree_work, &nodes[0]);
+  dispatch_queue_group_wait(queue, group);
+
+  for (int i = 0; i < kNodeCount; i++) {
+    TEST_ASSERT_EQUAL_INT(1, nodes[i].count);
+  }
+
+  dispatch_group_delete(group);
+  dispatch_queue_delete(queue);
+}
+
 TEST(dispatch_queue, test_mixed_durations1) {
   dispatch_queue_t *queue;
   dispatch_task_t *standard_task;
@@ -237,10 +449,427 @@ TEST(dispatch_queue, test_mixed_durations2) {
   dispatch_queue_delete(queue);
 }
 
+TEST(dispatch_queue, test_cancel) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  dispatch_group_t *group;
+  test_work_arg_t arg;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+  group = dispatch_group_create(3, true);
+
+  arg.count = 0;
+
+  // cancelled tasks are skipped, but can still be waited on
+  task = dispatch_task_create(do_limited_work, &arg, true);
+  dispatch_task_cancel(task);
+  dispatch_queue_task_add(queue, task);
+  dispatch_queue_task_wait(queue, task);
+  TEST_ASSERT_EQUAL_INT(0, arg.count);
+
+  dispatch_group_function_add(group, do_limited_work, &arg);
+  dispatch_group_function_add(group, do_limited_work, &arg);
+  dispatch_group_function_add(group, do_limited_work, &arg);
+  dispatch_group_cancel(group);
+  dispatch_queue_group_add(queue, group);
+  dispatch_queue_group_wait(queue, group);
+  TEST_ASSERT_EQUAL_INT(0, arg.count);
+
+  dispatch_group_delete(group);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_task_current) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  test_current_work_arg_t arg = {NULL, 0, 0};
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  // only a task performed by a queue has a current task
+  TEST_ASSERT_NULL(dispatch_task_current());
+
+  // a running task sees its own cancel through its current task
+  task = dispatch_task_create(do_cancellable_work, &arg, true);
+  dispatch_queue_task_add(queue, task);
+  for (int i = 0; i < 1000; i++) {
+    if (__atomic_load_n(&arg.started, __ATOMIC_SEQ_CST)) break;
+    look_busy(1);
+  }
+  dispatch_task_cancel(task);
+  dispatch_queue_task_wait(queue, task);
+  TEST_ASSERT(arg.task == task);
+  TEST_ASSERT_EQUAL_INT(1, arg.stopped);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_wait_timeout) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  dispatch_group_t *group;
+  test_gated_work_arg_t volatile arg;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+  const dispatch_time_t kTimeout = 1000;  // microseconds
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+  group = dispatch_group_create(2, true);
+
+  arg.open = 0;
+  arg.count = 0;
+
+  task = dispatch_queue_function_add(queue, do_gated_work, (void *)&arg, true);
+  dispatch_group_function_add(group, do_gated_work, (void *)&arg);
+  dispatch_group_function_add(group, do_gated_work, (void *)&arg);
+  dispatch_queue_group_add(queue, group);
+
+  // the gate is closed so every wait times out
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_TIMEOUT,
+                        dispatch_queue_task_wait_for(queue, task, kTimeout));
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_TIMEOUT,
+                        dispatch_queue_group_wait_for(queue, group, kTimeout));
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_TIMEOUT,
+                        dispatch_queue_wait_for(queue, kTimeout));
+  TEST_ASSERT_FALSE(dispatch_queue_task_poll(queue, task));
+  TEST_ASSERT_FALSE(dispatch_queue_group_poll(queue, group));
+
+  // the task and group are still valid after timing out
+  arg.open = 1;
+  TEST_ASSERT_EQUAL_INT(
+      DISPATCH_WAIT_SUCCESS,
+      dispatch_queue_task_wait_until(queue, task, DISPATCH_TIME_FOREVER));
+  dispatch_queue_group_wait(queue, group);
+  TEST_ASSERT_EQUAL_INT(DISPATCH_WAIT_SUCCESS,
+                        dispatch_queue_wait_until(queue, DISPATCH_TIME_FOREVER));
+  TEST_ASSERT_EQUAL_INT(3, arg.count);
+
+  dispatch_group_delete(group);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_wait_any) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *tasks[3];
+  test_gated_work_arg_t volatile gated_arg;
+  test_work_arg_t limited_arg;
+  size_t index;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  gated_arg.open = 0;
+  gated_arg.count = 0;
+  limited_arg.count = 0;
+
+  tasks[0] =
+      dispatch_queue_function_add(queue, do_gated_work, (void *)&gated_arg, true);
+  tasks[1] =
+      dispatch_queue_function_add(queue, do_limited_work, &limited_arg, true);
+  tasks[2] =
+      dispatch_queue_function_add(queue, do_gated_work, (void *)&gated_arg, true);
+
+  // only the limited task can finish while the gate is closed
+  dispatch_wait_any(tasks, 3, &index);
+  TEST_ASSERT_EQUAL_INT(1, index);
+  TEST_ASSERT_NULL(tasks[1]);
+  TEST_ASSERT_EQUAL_INT(1, limited_arg.count);
+
+  gated_arg.open = 1;
+  dispatch_wait_all(tasks, 3);
+  TEST_ASSERT_NULL(tasks[0]);
+  TEST_ASSERT_NULL(tasks[2]);
+  TEST_ASSERT_EQUAL_INT(2, gated_arg.count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_completion) {
+  dispatch_queue_t *queue;
+  dispatch_completion_t *completion;
+  test_work_arg_t args[8];
+  void *reaped[8];
+  size_t reaped_count = 0;
+  const int kTaskCount = 8;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+  completion = dispatch_completion_create(kTaskCount);
+
+  for (int i = 0; i < kTaskCount; i++) {
+    args[i].count = 0;
+    dispatch_completion_function_add(queue, completion, do_limited_work,
+                                     &args[i]);
+  }
+
+  // reap the finished tasks in batches
+  while (reaped_count < kTaskCount) {
+    reaped_count += dispatch_completion_wait(
+        completion, &reaped[reaped_count], kTaskCount - reaped_count);
+  }
+  TEST_ASSERT_EQUAL_INT(0, dispatch_completion_poll(completion, reaped, 1));
+
+  // every task was reaped exactly once
+  for (int i = 0; i < kTaskCount; i++) {
+    test_work_arg_t *arg = (test_work_arg_t *)reaped[i];
+    TEST_ASSERT_EQUAL_INT(1, arg->count);
+    arg->count++;
+  }
+  for (int i = 0; i < kTaskCount; i++) {
+    TEST_ASSERT_EQUAL_INT(2, args[i].count);
+  }
+
+  dispatch_completion_delete(completion);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_graph) {
+  dispatch_queue_t *queue;
+  dispatch_graph_t *graph;
+  test_graph_work_arg_t args[4];
+  size_t nodes[4];
+  const int kLaunchCount = 3;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  for (int i = 0; i < 4; i++) {
+    args[i].count = 0;
+    args[i].ordered = 0;
+    args[i].dependencies[0] = NULL;
+    args[i].dependencies[1] = NULL;
+  }
+
+  // capture a diamond, the middle tasks depend on the first and the last
+  // task depends on both of the middle tasks
+  graph = dispatch_graph_create(4);
+  nodes[0] = dispatch_graph_function_add(graph, do_graph_work, &args[0], NULL,
+                                         0);
+  for (int i = 1; i < 3; i++) {
+    args[i].dependencies[0] = &args[0];
+    nodes[i] = dispatch_graph_function_add(graph, do_graph_work, &args[i],
+                                           &nodes[0], 1);
+  }
+  args[3].dependencies[0] = &args[1];
+  args[3].dependencies[1] = &args[2];
+  nodes[3] = dispatch_graph_function_add(graph, do_graph_work, &args[3],
+                                         &nodes[1], 2);
+  dispatch_graph_finalize(graph);
+
+  // replay the graph
+  for (int i = 0; i < kLaunchCount; i++) {
+    dispatch_queue_graph_launch(queue, graph);
+    dispatch_queue_graph_wait(queue, graph);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_INT(kLaunchCount, args[i].count);
+    TEST_ASSERT_EQUAL_INT(kLaunchCount, args[i].ordered);
+  }
+
+  dispatch_graph_delete(graph);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_graph_cancel) {
+  dispatch_queue_t *queue;
+  dispatch_graph_t *graph;
+  test_graph_work_arg_t args[3];
+  size_t nodes[3];
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  for (int i = 0; i < 3; i++) {
+    args[i].count = 0;
+    args[i].ordered = 0;
+    args[i].dependencies[0] = NULL;
+    args[i].dependencies[1] = NULL;
+  }
+
+  // capture a chain, each task depends on the one before it
+  graph = dispatch_graph_create(3);
+  nodes[0] = dispatch_graph_function_add(graph, do_graph_work, &args[0], NULL,
+                                         0);
+  for (int i = 1; i < 3; i++) {
+    args[i].dependencies[0] = &args[i - 1];
+    nodes[i] = dispatch_graph_function_add(graph, do_graph_work, &args[i],
+                                           &nodes[i - 1], 1);
+  }
+  dispatch_graph_finalize(graph);
+
+  // the skipped tasks still release the tasks that depend on them
+  dispatch_graph_cancel(graph);
+  dispatch_queue_graph_launch(queue, graph);
+  dispatch_queue_graph_wait(queue, graph);
+  for (int i = 0; i < 3; i++) TEST_ASSERT_EQUAL_INT(0, args[i].count);
+
+  // the cancel ends with the wait
+  dispatch_queue_graph_launch(queue, graph);
+  dispatch_queue_graph_wait(queue, graph);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_INT(1, args[i].count);
+    TEST_ASSERT_EQUAL_INT(1, args[i].ordered);
+  }
+
+  dispatch_graph_delete(graph);
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_broadcast) {
+  dispatch_queue_t *queue;
+  dispatch_task_t *task;
+  test_work_arg_t broadcast_arg;
+  test_work_arg_t arg;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  queue = dispatch_queue_create(kQueueLength, kQueueThreadCount,
+                                QUEUE_THREAD_STACK_SIZE, QUEUE_THREAD_PRIORITY);
+
+  broadcast_arg.count = 0;
+  arg.count = 0;
+
+  // every worker performs the broadcast once, even on an idle queue
+  task = dispatch_queue_broadcast(queue, do_limited_work, &broadcast_arg);
+  dispatch_queue_task_wait(queue, task);
+  TEST_ASSERT_EQUAL_INT(kQueueThreadCount, broadcast_arg.count);
+
+  // busy workers perform the broadcast after their current task
+  for (int i = 0; i < kQueueThreadCount; i++) {
+    dispatch_queue_function_add(queue, do_standard_work, &arg, false);
+  }
+  task = dispatch_queue_broadcast(queue, do_limited_work, &broadcast_arg);
+  dispatch_queue_task_wait(queue, task);
+  TEST_ASSERT_EQUAL_INT(2 * kQueueThreadCount, broadcast_arg.count);
+
+  dispatch_queue_wait(queue);
+  TEST_ASSERT_EQUAL_INT(kQueueThreadCount, arg.count);
+
+  dispatch_queue_delete(queue);
+}
+
+TEST(dispatch_queue, test_worker_hooks) {
+  dispatch_queue_t *queue;
+  dispatch_queue_attr_t attr;
+  dispatch_task_t *task;
+  int contexts[QUEUE_THREAD_COUNT];
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+
+  worker_start_count = 0;
+  worker_stop_count = 0;
+  for (int i = 0; i < kQueueThreadCount; i++) contexts[i] = 0;
+
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = QUEUE_THREAD_STACK_SIZE;
+  attr.thread_priority = QUEUE_THREAD_PRIORITY;
+  attr.worker_start = start_worker;
+  attr.worker_stop = stop_worker;
+  attr.worker_argument = contexts;
+  queue = dispatch_queue_create_with_attr(kQueueLength, kQueueThreadCount,
+                                          &attr);
+
+  // every worker finds its own context
+  task = dispatch_queue_broadcast(queue, do_context_work, NULL);
+  dispatch_queue_task_wait(queue, task);
+
+  TEST_ASSERT_EQUAL_INT(kQueueThreadCount, worker_start_count);
+  for (int i = 0; i < kQueueThreadCount; i++) {
+    TEST_ASSERT_EQUAL_INT(1, contexts[i]);
+  }
+
+#if !FREERTOS
+  // not called from a worker
+  TEST_ASSERT_NULL(dispatch_worker_context());
+#endif
+
+  dispatch_queue_delete(queue);
+
+#if !BARE_METAL
+  // NOTE: bare-metal workers may stop after the queue is deleted
+  TEST_ASSERT_EQUAL_INT(kQueueThreadCount, worker_stop_count);
+#endif
+}
+
+TEST(dispatch_queue, test_storage) {
+  dispatch_queue_t *queue;
+  dispatch_queue_attr_t attr;
+  dispatch_group_t *group;
+  test_work_arg_t arg;
+  void *storage;
+  size_t storage_size;
+  const int kQueueLength = QUEUE_LENGTH;
+  const int kQueueThreadCount = QUEUE_THREAD_COUNT;
+  const int kGroupLength = 3;
+  const int kCycleCount = 2;
+
+  dispatch_queue_attr_init(&attr);
+  attr.thread_stack_size = QUEUE_THREAD_STACK_SIZE;
+  attr.thread_priority = QUEUE_THREAD_PRIORITY;
+  storage_size =
+      dispatch_queue_storage_size(kQueueLength, kQueueThreadCount, &attr);
+  storage = dispatch_malloc(storage_size);
+
+  group = dispatch_group_create(kGroupLength, true);
+  dispatch_group_set_reusable(group, true);
+  for (int i = 0; i < kGroupLength; i++) {
+    dispatch_group_function_add(group, do_standard_work, &arg);
+  }
+
+  // the storage can be used again once the queue is deleted
+  for (int i = 0; i < kCycleCount; i++) {
+    queue = dispatch_queue_create_with_storage(kQueueLength, kQueueThreadCount,
+                                               &attr, storage);
+    // the queue may be aligned past the start of the storage
+    TEST_ASSERT((char *)queue >= (char *)storage);
+    TEST_ASSERT((char *)queue < (char *)storage + storage_size);
+
+    arg.count = 0;
+    if (i > 0) dispatch_group_reset(group);
+    dispatch_queue_group_add(queue, group);
+    dispatch_queue_group_wait(queue, group);
+    TEST_ASSERT_EQUAL_INT(kGroupLength, arg.count);
+
+    dispatch_queue_delete(queue);
+  }
+
+  dispatch_group_delete(group);
+  dispatch_free(storage);
+}
+
 TEST_GROUP_RUNNER(dispatch_queue) {
   RUN_TEST_CASE(dispatch_queue, test_wait_queue)
+  RUN_TEST_CASE(dispatch_queue, test_prewarm);
   RUN_TEST_CASE(dispatch_queue, test_wait_task);
   RUN_TEST_CASE(dispatch_queue, test_wait_group);
+  RUN_TEST_CASE(dispatch_queue, test_reusable_group);
+  RUN_TEST_CASE(dispatch_queue, test_group_enter_leave);
   RUN_TEST_CASE(dispatch_queue, test_mixed_durations1);
   RUN_TEST_CASE(dispatch_queue, test_mixed_durations2);
+  RUN_TEST_CASE(dispatch_queue, test_cancel);
+  RUN_TEST_CASE(dispatch_queue, test_task_current);
+  RUN_TEST_CASE(dispatch_queue, test_wait_timeout);
+  RUN_TEST_CASE(dispatch_queue, test_wait_any);
+  RUN_TEST_CASE(dispatch_queue, test_completion);
+  RUN_TEST_CASE(dispatch_queue, test_graph);
+  RUN_TEST_CASE(dispatch_queue, test_graph_cancel);
+  RUN_TEST_CASE(dispatch_queue, test_broadcast);
+  RUN_TEST_CASE(dispatch_queue, test_worker_hooks);
+  RUN_TEST_CASE(dispatch_queue, test_storage);
 }
\ No newline at end of file
@@ -51,7 +51,42 @@ TEST(dispatch_task, test_perform) {
   dispatch_task_delete(task);
 }
 
+TEST(dispatch_task, test_cancel) {
+  dispatch_task_t *task;
+
+  task = dispatch_task_create(do_dispatch_task_work, NULL, false);
+  TEST_ASSERT_FALSE(dispatch_task_is_cancelled(task));
+
+  dispatch_task_cancel(task);
+  TEST_ASSERT_TRUE(dispatch_task_is_cancelled(task));
+
+  dispatch_task_delete(task);
+}
+
+TEST(dispatch_task, test_payload) {
+  dispatch_task_t *task;
+  test_work_arg_t *arg;
+
+  task = dispatch_task_create_with_payload(
+      do_dispatch_task_work, sizeof(test_work_arg_t), (void **)&arg, false);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_NOT_NULL(arg);
+  TEST_ASSERT_EQUAL_INT(0, (size_t)arg % sizeof(void *));
+
+  // the payload is passed to the function
+  arg->zero = 1;
+  arg->one = 0;
+  dispatch_task_perform(task);
+  TEST_ASSERT_EQUAL_INT(0, arg->zero);
+  TEST_ASSERT_EQUAL_INT(1, arg->one);
+
+  // the payload is freed with the task
+  dispatch_task_delete(task);
+}
+
 TEST_GROUP_RUNNER(dispatch_task) {
   RUN_TEST_CASE(dispatch_task, test_create);
   RUN_TEST_CASE(dispatch_task, test_perform);
+  RUN_TEST_CASE(dispatch_task, test_cancel);
+  RUN_TEST_CASE(dispatch_task, test_payload);
 }
\ No newline at end of file
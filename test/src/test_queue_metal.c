@@ -140,6 +140,48 @@ TEST(queue_metal, test_under_capacity) {
   chanend_free(cend);
 }
 
+TEST(queue_metal, test_receive_batch) {
+  const size_t kLength = 10;
+  const size_t kBatchSize = 4;
+  queue_t *queue = queue_create(kLength);
+  chanend_t cend = chanend_alloc();
+  int *items[kBatchSize];
+  size_t count;
+  int next = 0;
+
+  int pushed[kLength];
+  for (int i = 0; i < kLength; i++) {
+    pushed[i] = i;
+    queue_send(queue, &pushed[i], cend);
+  }
+
+  // one receiver takes a full batch
+  count = kBatchSize;
+  TEST_ASSERT_TRUE(
+      queue_receive_batch(queue, (void **)items, &count, 1, NULL, cend));
+  TEST_ASSERT_EQUAL_INT(kBatchSize, count);
+  for (int i = 0; i < count; i++) TEST_ASSERT_EQUAL_INT(next++, *items[i]);
+
+  // three receivers share the 6 items that are left
+  count = kBatchSize;
+  TEST_ASSERT_TRUE(
+      queue_receive_batch(queue, (void **)items, &count, 3, NULL, cend));
+  TEST_ASSERT_EQUAL_INT(2, count);
+  for (int i = 0; i < count; i++) TEST_ASSERT_EQUAL_INT(next++, *items[i]);
+
+  // a shallow queue is received one item at a time
+  count = kBatchSize;
+  TEST_ASSERT_TRUE(
+      queue_receive_batch(queue, (void **)items, &count, 8, NULL, cend));
+  TEST_ASSERT_EQUAL_INT(1, count);
+  TEST_ASSERT_EQUAL_INT(next++, *items[0]);
+
+  TEST_ASSERT_EQUAL_INT(kLength - next, queue_size(queue));
+
+  queue_delete(queue, cend);
+  chanend_free(cend);
+}
+
 TEST(queue_metal, test_fill_and_drain) {
   const size_t kLength = 10;
   const size_t kItems = 12;
@@ -307,6 +349,7 @@ TEST(queue_metal, test_shutdown) {
 TEST_GROUP_RUNNER(queue_metal) {
   RUN_TEST_CASE(queue_metal, test_full_capacity);
   RUN_TEST_CASE(queue_metal, test_under_capacity);
+  RUN_TEST_CASE(queue_metal, test_receive_batch);
   RUN_TEST_CASE(queue_metal, test_fill_and_drain);
   RUN_TEST_CASE(queue_metal, test_random_arrival);
   RUN_TEST_CASE(queue_metal, test_multiple_producers_and_consumers);